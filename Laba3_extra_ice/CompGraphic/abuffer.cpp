@@ -0,0 +1,18 @@
+#include "abuffer.h"
+
+ABuffer::ABuffer() : width_(0), height_(0), next_(0), overflow_(0) {
+}
+
+void ABuffer::resize(int width, int height, size_t max_bytes) {
+    size_t n = max_bytes / sizeof(Fragment);
+    if (width == width_ && height == height_ && n == pool_.size()) return;
+    width_ = width;
+    height_ = height;
+    heads_.assign(width * height, -1);
+    pool_.resize(n);
+}
+
+void ABuffer::clear() {
+    next_ = 0;
+    overflow_ = 0;
+}
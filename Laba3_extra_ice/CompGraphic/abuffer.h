@@ -0,0 +1,62 @@
+#ifndef __ABUFFER_H__
+#define __ABUFFER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "tgaimage.h"
+
+// Per-pixel linked lists of transparent fragments for exact, sorted compositing.
+// Fragments come from one pool preallocated per frame and handed out with an
+// atomic counter, so tiles may insert concurrently. Heads are per pixel and only
+// touched by the slice that owns the pixel. When the pool is exhausted further
+// fragments are dropped and counted.
+class ABuffer {
+public:
+	struct Fragment {
+		float z;
+		unsigned char rgba[4];
+		int next;      // -1 ends the list
+	};
+
+	// fragments of one pixel past this are dropped during compositing
+	static const int MAX_PIXEL_FRAGMENTS = 32;
+
+	ABuffer();
+	void resize(int width, int height, size_t max_bytes); // max_bytes caps the fragment pool, no-op if unchanged
+	void clear();                                          // new frame, heads must already be empty
+
+	void insert(int x, int y, float z, const TGAColor& c) {
+		int i = next_.fetch_add(1, std::memory_order_relaxed);
+		if (i >= (int)pool_.size()) {
+			overflow_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Fragment& f = pool_[i];
+		int& head = heads_[x + y * width_];
+		f.z = z;
+		f.rgba[0] = c.r;
+		f.rgba[1] = c.g;
+		f.rgba[2] = c.b;
+		f.rgba[3] = c.a;
+		f.next = head;
+		head = i;
+	}
+
+	int head(int x, int y) const { return heads_[x + y * width_]; }
+	void reset_head(int x, int y) { heads_[x + y * width_] = -1; }
+	const Fragment& fragment(int i) const { return pool_[i]; }
+
+	void count_overflow(long long n) { overflow_.fetch_add(n, std::memory_order_relaxed); }
+	long long overflow() const { return overflow_; }
+	int used() const { return std::min(next_.load(), (int)pool_.size()); }
+	int capacity() const { return (int)pool_.size(); }
+private:
+	int width_, height_;
+	std::vector<int> heads_;
+	std::vector<Fragment> pool_;
+	std::atomic<int> next_;
+	std::atomic<long long> overflow_;
+};
+
+#endif //__ABUFFER_H__
@@ -0,0 +1,10 @@
+#ifndef __ALLOC_STATS_H__
+#define __ALLOC_STATS_H__
+
+// Process-wide heap allocation counters. alloc_stats.cpp replaces the global
+// operator new and delete, every allocation made through them is counted,
+// the standard containers' included.
+long long heap_allocations();  // operator new calls since start
+long long heap_bytes();        // bytes requested by them
+
+#endif //__ALLOC_STATS_H__
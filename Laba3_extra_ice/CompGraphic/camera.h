@@ -26,12 +26,12 @@ public:
         up.normalize();
     }
 
-    Matrix getViewMatrix() {
+    Mat4f getViewMatrix() {
         Vec3f z = (eye - target).normalize();
         Vec3f x = cross(up, z).normalize();
         Vec3f y = cross(z, x).normalize();
 
-        Matrix view = Matrix::identity(4);
+        Mat4f view = Mat4f::identity();
 
         view[0][0] = x.x; view[0][1] = x.y; view[0][2] = x.z;
         view[1][0] = y.x; view[1][1] = y.y; view[1][2] = y.z;
@@ -44,8 +44,8 @@ public:
         return view;
     }
 
-    Matrix getProjectionMatrix() {
-        Matrix proj = Matrix::identity(4);
+    Mat4f getProjectionMatrix() {
+        Mat4f proj = Mat4f::identity();
 
         float tanHalfFov = tan(fov * 3.14159265f / 360.0f);
         float range = znear - zfar;
@@ -60,7 +60,7 @@ public:
         return proj;
     }
 
-    Matrix getViewProjectionMatrix() {
+    Mat4f getViewProjectionMatrix() {
         return getProjectionMatrix() * getViewMatrix();
     }
 
@@ -72,6 +72,12 @@ public:
     float getZNear() const { return znear; }
     float getZFar() const { return zfar; }
 
+    // NDC depth of a point at the given distance in front of the camera
+    float getNdcDepth(float distance) {
+        Mat4f proj = getProjectionMatrix();
+        return proj[2][2] - proj[2][3] / distance;
+    }
+
 private:
     float dot(const Vec3f& a, const Vec3f& b) {
         return a.x * b.x + a.y * b.y + a.z * b.z;
@@ -0,0 +1,145 @@
+#include "clipper.h"
+
+// Works on the negated clip vector like compute_outcodes, w > 0 in front of the camera.
+
+namespace {
+
+struct PolyVert {
+    float c[4];                   // negated clip-space position
+    float v[MAX_VARYINGS];
+};
+
+// signed distance to one clip plane, inside if >= 0
+float plane_distance(const PolyVert& p, int plane, float znear, float gx, float gy) {
+    switch (plane) {
+    case CLIP_NEAR: return p.c[3] - znear;
+    case GUARD_LEFT: return p.c[0] + gx * p.c[3];
+    case GUARD_RIGHT: return gx * p.c[3] - p.c[0];
+    case GUARD_BOTTOM: return p.c[1] + gy * p.c[3];
+    default: return gy * p.c[3] - p.c[1];
+    }
+}
+
+// Sutherland-Hodgman against a single plane
+int clip_polygon(const PolyVert* in, int n, PolyVert* out, int nvaryings, int plane, float znear, float gx, float gy) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const PolyVert& a = in[i];
+        const PolyVert& b = in[(i + 1) % n];
+        float da = plane_distance(a, plane, znear, gx, gy);
+        float db = plane_distance(b, plane, znear, gx, gy);
+        if (da >= 0) out[m++] = a;
+        if ((da >= 0) != (db >= 0)) {
+            float t = da / (da - db);
+            PolyVert& p = out[m++];
+            for (int k = 0; k < 4; k++) p.c[k] = a.c[k] + (b.c[k] - a.c[k]) * t;
+            for (int k = 0; k < nvaryings; k++) p.v[k] = a.v[k] + (b.v[k] - a.v[k]) * t;
+        }
+    }
+    return m;
+}
+
+// twice the signed area after pixel snapping, the rasterizers see exactly this triangle
+long long snapped_area(const TriangleCmd& t) {
+    int x0 = (int)t.t[0].x, y0 = (int)t.t[0].y;
+    return (long long)((int)t.t[1].x - x0) * ((int)t.t[2].y - y0)
+        - (long long)((int)t.t[1].y - y0) * ((int)t.t[2].x - x0);
+}
+
+// false if the triangle should not reach the rasterizer
+bool keep_triangle(const TriangleCmd& t, ClipStats& stats) {
+    long long area = snapped_area(t);
+    if (area == 0) {
+        stats.degenerate++;
+        return false;
+    }
+    if (t.cull_back && area < 0) {
+        stats.culled++;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int clip_triangle(VertexCache& cache, const int idx[3], const TriangleCmd& tri,
+    int width, int height, TriangleCmd* out, ClipStats& stats) {
+    const ScreenVerts& sv = cache.verts();
+    stats.triangles++;
+    unsigned short c0 = sv.outcode[idx[0]], c1 = sv.outcode[idx[1]], c2 = sv.outcode[idx[2]];
+
+    const unsigned short reject_bits = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR;
+    if (c0 & c1 & c2 & reject_bits) {
+        stats.rejected++;
+        return 0;
+    }
+
+    const unsigned short clip_bits = CLIP_NEAR | GUARD_LEFT | GUARD_RIGHT | GUARD_BOTTOM | GUARD_TOP;
+    unsigned short planes = (c0 | c1 | c2) & clip_bits;
+
+    if (!planes) {
+        // trivial accept, the vertex stage already produced everything
+        out[0] = tri;
+        for (int j = 0; j < 3; j++) {
+            out[0].t[j] = cache.screen(idx[j]);
+            out[0].inv_w[j] = cache.inv_w(idx[j]);
+        }
+        stats.accepted++;
+        return keep_triangle(out[0], stats) ? 1 : 0;
+    }
+
+    stats.clipped++;
+    const float gx = 1.0f + 2.0f * GUARD_BAND_PIXELS / width;
+    const float gy = 1.0f + 2.0f * GUARD_BAND_PIXELS / height;
+
+    PolyVert buf[2][MAX_CLIP_VERTS];
+    int n = 3;
+    for (int j = 0; j < 3; j++) {
+        int i = idx[j];
+        PolyVert& p = buf[0][j];
+        p.c[0] = -sv.cx[i];
+        p.c[1] = -sv.cy[i];
+        p.c[2] = -sv.cz[i];
+        p.c[3] = -sv.cw[i];
+        for (int k = 0; k < tri.nvaryings; k++) p.v[k] = tri.varyings[j][k];
+    }
+
+    int cur = 0;
+    const int order[] = { CLIP_NEAR, GUARD_LEFT, GUARD_RIGHT, GUARD_BOTTOM, GUARD_TOP };
+    for (int plane : order) {
+        if (!(planes & plane)) continue;
+        n = clip_polygon(buf[cur], n, buf[1 - cur], tri.nvaryings, plane, sv.znear, gx, gy);
+        cur = 1 - cur;
+        if (n < 3) {
+            stats.rejected++;
+            return 0;
+        }
+    }
+
+    // project the polygon and fan it into triangles
+    Vec3f screen[MAX_CLIP_VERTS];
+    float inv_w[MAX_CLIP_VERTS];
+    for (int i = 0; i < n; i++) {
+        const PolyVert& p = buf[cur][i];
+        float w = p.c[3];
+        screen[i] = Vec3f(
+            (int)((p.c[0] / w + 1.0f) * (width * 0.5f) + 0.5f),
+            (int)((p.c[1] / w + 1.0f) * (height * 0.5f) + 0.5f),
+            p.c[2] / w);
+        inv_w[i] = -1.0f / w; // 1/w of the original (not negated) clip vector, like the vertex stage
+    }
+
+    int count = 0;
+    for (int i = 1; i + 1 < n; i++) {
+        TriangleCmd& t = out[count];
+        t = tri;
+        const int fan[3] = { 0, i, i + 1 };
+        for (int j = 0; j < 3; j++) {
+            t.t[j] = screen[fan[j]];
+            t.inv_w[j] = inv_w[fan[j]];
+            for (int k = 0; k < tri.nvaryings; k++) t.varyings[j][k] = buf[cur][fan[j]].v[k];
+        }
+        if (keep_triangle(t, stats)) count++;
+    }
+    return count;
+}
@@ -0,0 +1,29 @@
+#ifndef __CLIPPER_H__
+#define __CLIPPER_H__
+
+#include "rasterizer.h"
+#include "vertex_cache.h"
+
+// near plane and four guard planes turn a triangle into at most 8 vertices
+const int MAX_CLIP_VERTS = 8;
+const int MAX_CLIP_TRIANGLES = MAX_CLIP_VERTS - 2;
+
+struct ClipStats {
+	long long triangles;   // submitted
+	long long accepted;    // inside the guard band, no clipping needed
+	long long clipped;     // went through Sutherland-Hodgman
+	long long rejected;    // outside the frustum
+	long long culled;      // facing away, see TriangleCmd::cull_back
+	long long degenerate;  // zero screen area after snapping
+
+	ClipStats() { reset(); }
+	void reset() { triangles = accepted = clipped = rejected = culled = degenerate = 0; }
+};
+
+// Takes triangle idx[0..2] of the cache with shading state and per-vertex varyings
+// already set in tri, writes up to MAX_CLIP_TRIANGLES rasterizable triangles to out.
+// Returns how many were written.
+int clip_triangle(VertexCache& cache, const int idx[3], const TriangleCmd& tri,
+	int width, int height, TriangleCmd* out, ClipStats& stats);
+
+#endif //__CLIPPER_H__
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstring>
+#include "color_buffer.h"
+
+// std::min() takes it by reference
+const int ColorBuffer::TILE_SIZE;
+
+ColorBuffer::ColorBuffer(int width, int height, int bytespp)
+    : width_(width), height_(height), bytespp_(bytespp), image_(width, height, bytespp) {
+    pixels_ = image_.buffer();
+    tiles_x_ = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y_ = (height + TILE_SIZE - 1) / TILE_SIZE;
+    // a new image is already zero-filled, as is the default clear color
+    state_.assign(tiles_x_ * tiles_y_, TILE_CLEAN);
+}
+
+void ColorBuffer::clear(const TGAColor& color) {
+    bool same = memcmp(color.raw, clear_color_.raw, bytespp_) == 0;
+    clear_color_ = color;
+    for (auto& s : state_) {
+        if (s != TILE_CLEAN || !same) s = TILE_CLEARED;
+    }
+}
+
+void ColorBuffer::tile_rect(int tile, int& x0, int& y0, int& w, int& h) const {
+    x0 = (tile % tiles_x_) * TILE_SIZE;
+    y0 = (tile / tiles_x_) * TILE_SIZE;
+    w = std::min(TILE_SIZE, width_ - x0);
+    h = std::min(TILE_SIZE, height_ - y0);
+}
+
+void ColorBuffer::fill(unsigned char* dst, int stride, int w, int h) const {
+    // first row pixel by pixel, the others copy it
+    for (int x = 0; x < w; x++) {
+        for (int ch = 0; ch < bytespp_; ch++) dst[x * bytespp_ + ch] = clear_color_.raw[ch];
+    }
+    for (int y = 1; y < h; y++) {
+        memcpy(dst + y * stride * bytespp_, dst, w * bytespp_);
+    }
+}
+
+void ColorBuffer::load_tile(int tile, unsigned char* dst, int stride) const {
+    int x0, y0, w, h;
+    tile_rect(tile, x0, y0, w, h);
+    if (state_[tile] != TILE_WRITTEN) {
+        fill(dst, stride, w, h);
+        return;
+    }
+    const unsigned char* src = pixels_ + (x0 + y0 * width_) * bytespp_;
+    for (int y = 0; y < h; y++) {
+        memcpy(dst + y * stride * bytespp_, src + y * width_ * bytespp_, w * bytespp_);
+    }
+}
+
+void ColorBuffer::store_tile(int tile, const unsigned char* src, int stride) {
+    int x0, y0, w, h;
+    tile_rect(tile, x0, y0, w, h);
+    unsigned char* dst = pixels_ + (x0 + y0 * width_) * bytespp_;
+    for (int y = 0; y < h; y++) {
+        memcpy(dst + y * width_ * bytespp_, src + y * stride * bytespp_, w * bytespp_);
+    }
+    state_[tile] = TILE_WRITTEN;
+}
+
+void ColorBuffer::resolve() {
+    for (int tile = 0; tile < (int)state_.size(); tile++) {
+        if (state_[tile] != TILE_CLEARED) continue;
+        int x0, y0, w, h;
+        tile_rect(tile, x0, y0, w, h);
+        fill(pixels_ + (x0 + y0 * width_) * bytespp_, width_, w, h);
+        state_[tile] = TILE_CLEAN;
+    }
+}
+
+unsigned char* ColorBuffer::materialize() {
+    resolve();
+    std::fill(state_.begin(), state_.end(), TILE_WRITTEN);
+    return pixels_;
+}
+
+unsigned char* ColorBuffer::materialize(int x0, int y0, int x1, int y1) {
+    int tx0 = std::max(x0, 0) / TILE_SIZE, tx1 = std::min(x1, width_ - 1) / TILE_SIZE;
+    int ty0 = std::max(y0, 0) / TILE_SIZE, ty1 = std::min(y1, height_ - 1) / TILE_SIZE;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            int tile = tx + ty * tiles_x_;
+            if (state_[tile] == TILE_CLEARED) {
+                int px, py, w, h;
+                tile_rect(tile, px, py, w, h);
+                fill(pixels_ + (px + py * width_) * bytespp_, width_, w, h);
+            }
+            state_[tile] = TILE_WRITTEN;
+        }
+    }
+    return pixels_;
+}
@@ -0,0 +1,52 @@
+#ifndef __COLOR_BUFFER_H__
+#define __COLOR_BUFFER_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+// Color render target: a TGAImage plus a clear state per TILE_SIZE tile.
+// clear() only sets the states, a cleared tile gets the clear color when it is
+// first loaded by the renderer or when resolve() materializes the untouched
+// ones. A tile that already holds the clear color from an earlier frame and
+// was not written since is not filled again. Distinct tiles may be loaded and
+// stored concurrently.
+class ColorBuffer {
+public:
+	static const int TILE_SIZE = 64;
+
+	ColorBuffer(int width, int height, int bytespp = TGAImage::RGB);
+	void clear(const TGAColor& color); // O(tiles)
+	void resolve();                    // must be called before reading image()
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int bytespp() const { return bytespp_; }
+	TGAImage& image() { return image_; } // write only through the methods below or after materialize()
+
+	// dst/src point at the first pixel of the tile, stride in pixels
+	void load_tile(int tile, unsigned char* dst, int stride) const;
+	void store_tile(int tile, const unsigned char* src, int stride);
+	// resolves and hands out the whole frame for direct writes
+	unsigned char* materialize();
+	// same, but only the tiles overlapping pixels [x0, x1] x [y0, y1] may be
+	// written through the result
+	unsigned char* materialize(int x0, int y0, int x1, int y1);
+private:
+	enum TileState {
+		TILE_CLEARED,  // clear color pending
+		TILE_CLEAN,    // holds the clear color
+		TILE_WRITTEN
+	};
+
+	int width_, height_, bytespp_;
+	int tiles_x_, tiles_y_;
+	TGAImage image_;
+	unsigned char* pixels_; // image_.buffer()
+	TGAColor clear_color_;
+	std::vector<unsigned char> state_;
+
+	void tile_rect(int tile, int& x0, int& y0, int& w, int& h) const;
+	void fill(unsigned char* dst, int stride, int w, int h) const;
+};
+
+#endif //__COLOR_BUFFER_H__
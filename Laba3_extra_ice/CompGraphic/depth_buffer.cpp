@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstring>
+#include "depth_buffer.h"
+
+// std::min() takes it by reference
+const int DepthBuffer::TILE_SIZE;
+
+DepthBuffer::DepthBuffer(int width, int height, DepthFormat format, bool compression)
+    : width_(width), height_(height), format_(format), compression_(compression),
+      bytes_read_(0), bytes_written_(0) {
+    tiles_x_ = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y_ = (height + TILE_SIZE - 1) / TILE_SIZE;
+    max_code_ = format == DEPTH_D16 ? 0xFFFF : 0xFFFFFF;
+    set_range(0.0f, 1.0f);
+    tiles_.resize(tiles_x_ * tiles_y_);
+    data_.resize(tiles_.size() * TILE_SIZE * TILE_SIZE * bytes_per_pixel());
+    clear();
+}
+
+int DepthBuffer::bytes_per_pixel() const {
+    switch (format_) {
+    case DEPTH_D16: return 2;
+    case DEPTH_D24: return 3;
+    default: return 4;
+    }
+}
+
+void DepthBuffer::set_range(float farthest, float nearest) {
+    far_ = farthest;
+    near_ = nearest;
+    scale_ = (max_code_ - 1) / ((double)nearest - farthest);
+    inv_scale_ = 1.0 / scale_;
+}
+
+void DepthBuffer::clear() {
+    bytes_read_ = 0;
+    bytes_written_ = 0;
+    if (compression_) {
+        for (auto& t : tiles_) t.state = TILE_CLEARED;
+        return;
+    }
+    // every pixel is written, code 0 for the unorm formats
+    for (auto& t : tiles_) t.state = TILE_RAW;
+    if (format_ == DEPTH_D32F) {
+        float* z = (float*)data_.data();
+        std::fill(z, z + data_.size() / sizeof(float), DEPTH_CLEAR);
+    }
+    else {
+        std::fill(data_.begin(), data_.end(), 0);
+    }
+    bytes_written_ = (long long)width_ * height_ * bytes_per_pixel();
+}
+
+void DepthBuffer::tile_rect(int tile, int& x0, int& y0, int& w, int& h) const {
+    x0 = (tile % tiles_x_) * TILE_SIZE;
+    y0 = (tile / tiles_x_) * TILE_SIZE;
+    w = std::min(TILE_SIZE, width_ - x0);
+    h = std::min(TILE_SIZE, height_ - y0);
+}
+
+unsigned DepthBuffer::encode(float z) const {
+    if (z == DEPTH_CLEAR) return 0;
+    double d = (z - far_) * scale_;
+    d = std::min(std::max(d, 0.0), (double)(max_code_ - 1));
+    return 1 + (unsigned)(d + 0.5);
+}
+
+float DepthBuffer::decode(unsigned code) const {
+    if (code == 0) return DEPTH_CLEAR;
+    return (float)(far_ + (code - 1) * inv_scale_);
+}
+
+// Plane through the first, last-in-row and last-in-column pixels; true if every
+// pixel of the tile stores the same as the plane evaluated at it
+bool DepthBuffer::fit_plane(const float* src, int stride, int w, int h, float plane[3]) const {
+    float a = src[0];
+    float b = w > 1 ? (src[w - 1] - a) / (w - 1) : 0.0f;
+    float c = h > 1 ? (src[(h - 1) * stride] - a) / (h - 1) : 0.0f;
+    for (int y = 0; y < h; y++) {
+        const float* row = src + y * stride;
+        for (int x = 0; x < w; x++) {
+            if (row[x] == DEPTH_CLEAR) return false;
+            float z = a + b * x + c * y;
+            if (format_ == DEPTH_D32F ? z != row[x] : encode(z) != encode(row[x])) return false;
+        }
+    }
+    plane[0] = a;
+    plane[1] = b;
+    plane[2] = c;
+    return true;
+}
+
+void DepthBuffer::load_tile(int tile, float* dst, int stride) const {
+    int x0, y0, w, h;
+    tile_rect(tile, x0, y0, w, h);
+    const Tile& t = tiles_[tile];
+    if (t.state == TILE_CLEARED) {
+        for (int y = 0; y < h; y++) std::fill(dst + y * stride, dst + y * stride + w, DEPTH_CLEAR);
+        return;
+    }
+    if (t.state == TILE_PLANE) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) dst[x + y * stride] = t.plane[0] + t.plane[1] * x + t.plane[2] * y;
+        }
+        bytes_read_.fetch_add(sizeof(t.plane), std::memory_order_relaxed);
+        return;
+    }
+
+    int bpp = bytes_per_pixel();
+    const unsigned char* p = data_.data() + (size_t)tile * TILE_SIZE * TILE_SIZE * bpp;
+    for (int y = 0; y < h; y++) {
+        float* row = dst + y * stride;
+        if (format_ == DEPTH_D32F) {
+            memcpy(row, p, w * sizeof(float));
+        }
+        else if (format_ == DEPTH_D24) {
+            for (int x = 0; x < w; x++) row[x] = decode(p[3 * x] | (p[3 * x + 1] << 8) | (p[3 * x + 2] << 16));
+        }
+        else {
+            for (int x = 0; x < w; x++) row[x] = decode(p[2 * x] | (p[2 * x + 1] << 8));
+        }
+        p += w * bpp;
+    }
+    bytes_read_.fetch_add((long long)w * h * bpp, std::memory_order_relaxed);
+}
+
+void DepthBuffer::store_tile(int tile, const float* src, int stride) {
+    int x0, y0, w, h;
+    tile_rect(tile, x0, y0, w, h);
+    Tile& t = tiles_[tile];
+    if (compression_) {
+        bool cleared = true;
+        for (int y = 0; y < h && cleared; y++) {
+            for (int x = 0; x < w; x++) {
+                if (src[x + y * stride] != DEPTH_CLEAR) {
+                    cleared = false;
+                    break;
+                }
+            }
+        }
+        if (cleared) {
+            t.state = TILE_CLEARED;
+            return;
+        }
+        if (fit_plane(src, stride, w, h, t.plane)) {
+            t.state = TILE_PLANE;
+            bytes_written_.fetch_add(sizeof(t.plane), std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    t.state = TILE_RAW;
+    int bpp = bytes_per_pixel();
+    unsigned char* p = data_.data() + (size_t)tile * TILE_SIZE * TILE_SIZE * bpp;
+    for (int y = 0; y < h; y++) {
+        const float* row = src + y * stride;
+        if (format_ == DEPTH_D32F) {
+            memcpy(p, row, w * sizeof(float));
+        }
+        else {
+            for (int x = 0; x < w; x++) {
+                unsigned code = encode(row[x]);
+                for (int i = 0; i < bpp; i++) p[bpp * x + i] = (unsigned char)(code >> (8 * i));
+            }
+        }
+        p += w * bpp;
+    }
+    bytes_written_.fetch_add((long long)w * h * bpp, std::memory_order_relaxed);
+}
+
+void DepthBuffer::load(float* dst) const {
+    for (int tile = 0; tile < (int)tiles_.size(); tile++) {
+        int x0, y0, w, h;
+        tile_rect(tile, x0, y0, w, h);
+        load_tile(tile, dst + x0 + y0 * width_, width_);
+    }
+}
+
+void DepthBuffer::store(const float* src) {
+    for (int tile = 0; tile < (int)tiles_.size(); tile++) {
+        int x0, y0, w, h;
+        tile_rect(tile, x0, y0, w, h);
+        store_tile(tile, src + x0 + y0 * width_, width_);
+    }
+}
+
+void DepthBuffer::tile_counts(int& cleared, int& plane, int& raw) const {
+    cleared = plane = raw = 0;
+    for (const auto& t : tiles_) {
+        if (t.state == TILE_CLEARED) cleared++;
+        else if (t.state == TILE_PLANE) plane++;
+        else raw++;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef __DEPTH_BUFFER_H__
+#define __DEPTH_BUFFER_H__
+
+#include <atomic>
+#include <limits>
+#include <vector>
+
+enum DepthFormat {
+	DEPTH_D16,   // 16-bit unorm over the set_range() interval
+	DEPTH_D24,   // 24-bit unorm, packed 3 bytes per pixel
+	DEPTH_D32F   // raw float
+};
+
+// Depth of a cleared pixel, behind everything (depth grows towards the camera)
+const float DEPTH_CLEAR = -std::numeric_limits<float>::max();
+
+// Frame depth in a storage format, split into TILE_SIZE tiles that the renderer
+// loads into a float tile buffer, rasterizes and stores back. Each tile is kept
+// either cleared (no data), as a plane z = a + b*x + c*y when every pixel fits it
+// exactly in the storage format, or raw. With compression clear() only resets
+// the tile states, without it every pixel is written.
+// Unorm formats keep code 0 for DEPTH_CLEAR, depths outside the range clamp to it.
+// Distinct tiles may be loaded and stored concurrently.
+class DepthBuffer {
+public:
+	static const int TILE_SIZE = 64;
+
+	DepthBuffer(int width, int height, DepthFormat format = DEPTH_D24, bool compression = true);
+	void set_range(float farthest, float nearest); // depth interval of the unorm formats
+	float farthest() const { return (float)far_; }
+	float nearest() const { return (float)near_; }
+	void clear();                                  // fast clear, also resets the traffic counters
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int tiles_x() const { return tiles_x_; }
+	int tiles_y() const { return tiles_y_; }
+	DepthFormat format() const { return format_; }
+	bool compression() const { return compression_; }
+	int bytes_per_pixel() const;
+	bool tile_cleared(int tile) const { return tiles_[tile].state == TILE_CLEARED; }
+
+	// dst/src point at the first pixel of the tile, stride in floats
+	void load_tile(int tile, float* dst, int stride) const;
+	void store_tile(int tile, const float* src, int stride);
+	// whole frame, row stride = width
+	void load(float* dst) const;
+	void store(const float* src);
+
+	// payload bytes moved since clear(), tile states cost nothing, a plane 12 bytes
+	long long bytes_read() const { return bytes_read_; }
+	long long bytes_written() const { return bytes_written_; }
+	void tile_counts(int& cleared, int& plane, int& raw) const;
+private:
+	enum TileState { TILE_CLEARED, TILE_PLANE, TILE_RAW };
+	struct Tile {
+		unsigned char state;
+		float plane[3];   // a, b, c relative to the tile origin
+	};
+
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	DepthFormat format_;
+	bool compression_;
+	double far_, near_, scale_, inv_scale_;  // unorm: code = 1 + (z - far) * scale
+	unsigned max_code_;
+	std::vector<Tile> tiles_;
+	std::vector<unsigned char> data_; // TILE_SIZE^2 pixels per tile, tile after tile
+	mutable std::atomic<long long> bytes_read_;
+	std::atomic<long long> bytes_written_;
+
+	void tile_rect(int tile, int& x0, int& y0, int& w, int& h) const;
+	unsigned encode(float z) const;
+	float decode(unsigned code) const;
+	bool fit_plane(const float* src, int stride, int w, int h, float plane[3]) const;
+};
+
+#endif //__DEPTH_BUFFER_H__
@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cstdint>
+#include "frame_arena.h"
+
+FrameArena::FrameArena(size_t block_bytes)
+    : block_bytes_(block_bytes), current_(0), offset_(0), used_(0), peak_(0) {
+}
+
+FrameArena::~FrameArena() {
+    for (const Block& b : blocks_) delete[] b.data;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t align) {
+    // the current block first, then blocks left over from before, then a new one
+    for (; current_ < blocks_.size(); current_++, offset_ = 0) {
+        const Block& b = blocks_[current_];
+        uintptr_t base = (uintptr_t)b.data;
+        size_t start = ((base + offset_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (start + bytes <= b.size) {
+            offset_ = start + bytes;
+            used_ += bytes;
+            return b.data + start;
+        }
+    }
+    Block b = { nullptr, std::max(block_bytes_, bytes + align) };
+    b.data = new char[b.size];
+    blocks_.push_back(b);
+    uintptr_t base = (uintptr_t)b.data;
+    size_t start = ((base + align - 1) & ~(uintptr_t)(align - 1)) - base;
+    offset_ = start + bytes;
+    used_ += bytes;
+    return b.data + start;
+}
+
+void FrameArena::reset() {
+    peak_ = std::max(peak_, used_);
+    if (blocks_.size() > 1) {
+        size_t total = capacity();
+        for (const Block& b : blocks_) delete[] b.data;
+        blocks_.clear();
+        Block b = { new char[total], total };
+        blocks_.push_back(b);
+    }
+    current_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
+
+size_t FrameArena::peak() const {
+    return std::max(peak_, used_);
+}
+
+size_t FrameArena::capacity() const {
+    size_t total = 0;
+    for (const Block& b : blocks_) total += b.size;
+    return total;
+}
@@ -0,0 +1,45 @@
+#ifndef __FRAME_ARENA_H__
+#define __FRAME_ARENA_H__
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for data that lives for one frame. Allocations only move a
+// pointer, nothing is freed individually: reset() at the start of the next
+// frame takes everything back at once. A frame that doesn't fit gets extra
+// blocks; reset() then folds them into one block of the combined size, so
+// after the first frames the arena stops touching the heap.
+class FrameArena {
+public:
+	explicit FrameArena(size_t block_bytes = 1 << 20);
+	~FrameArena();
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+	// uninitialized, no destructors are run
+	template <class T> T* alloc(size_t count) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+	void reset();
+
+	size_t used() const { return used_; }  // bytes handed out since reset()
+	size_t peak() const;                   // largest frame so far
+	size_t capacity() const;
+	int blocks() const { return (int)blocks_.size(); }
+private:
+	struct Block {
+		char* data;
+		size_t size;
+	};
+	std::vector<Block> blocks_;
+	size_t block_bytes_;
+	size_t current_;  // block being filled
+	size_t offset_;   // in blocks_[current_]
+	size_t used_;
+	size_t peak_;
+};
+
+#endif //__FRAME_ARENA_H__
@@ -7,6 +7,11 @@
 #include <vector>
 #include <algorithm>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GEOMETRY_SSE2
+#include <emmintrin.h>
+#endif
+
 template <class t> struct Vec2 {
     t x, y;
 
@@ -177,11 +182,17 @@ public:
     }
 
     Vec3f operator*(const Vec3f& v) const {
+        float w;
+        return project(v, w);
+    }
+
+    // Same as operator*(Vec3f), also returns w before the perspective divide
+    Vec3f project(const Vec3f& v, float& w) const {
         assert(rows == 4 && cols == 4);
         float x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3];
         float y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3];
         float z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3];
-        float w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
+        w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
 
         if (w != 0.0f) {
             x /= w;
@@ -213,4 +224,109 @@ public:
     }
 };
 
+// Fixed-size 4D types for the transform path. Unlike Matrix they never touch
+// the heap, rows are 16-byte aligned so SSE can load them directly.
+struct alignas(16) Vec4f {
+    float x, y, z, w;
+
+    constexpr Vec4f() : x(0), y(0), z(0), w(0) {}
+    constexpr Vec4f(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+    Vec4f(const Vec3f& v, float _w) : x(v.x), y(v.y), z(v.z), w(_w) {}
+
+    Vec3f xyz() const { return Vec3f(x, y, z); }
+
+    // perspective divide, leaves the point as is when w == 0 like Matrix::operator*(Vec3f)
+    Vec3f project() const {
+        if (w != 0.0f) return Vec3f(x / w, y / w, z / w);
+        return Vec3f(x, y, z);
+    }
+
+    float& operator[](const int i) {
+        if (i == 0) return x;
+        else if (i == 1) return y;
+        else if (i == 2) return z;
+        else return w;
+    }
+
+    constexpr const float& operator[](const int i) const {
+        return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w));
+    }
+};
+
+struct alignas(16) Mat4f {
+    float m[4][4]; // row-major, m[row][col]
+
+    constexpr Mat4f() : m{ {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0} } {}
+
+    static constexpr Mat4f identity() {
+        Mat4f E;
+        for (int i = 0; i < 4; i++) E.m[i][i] = 1.0f;
+        return E;
+    }
+
+    constexpr float* operator[](const int i) { return m[i]; }
+    constexpr const float* operator[](const int i) const { return m[i]; }
+
+    constexpr Mat4f transpose() const {
+        Mat4f result;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                result.m[j][i] = m[i][j];
+        return result;
+    }
+
+    Mat4f operator*(const Mat4f& a) const {
+        Mat4f result;
+#ifdef GEOMETRY_SSE2
+        __m128 b0 = _mm_load_ps(a.m[0]), b1 = _mm_load_ps(a.m[1]);
+        __m128 b2 = _mm_load_ps(a.m[2]), b3 = _mm_load_ps(a.m[3]);
+        for (int i = 0; i < 4; i++) {
+            __m128 row = _mm_mul_ps(_mm_set1_ps(m[i][0]), b0);
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i][1]), b1));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i][2]), b2));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m[i][3]), b3));
+            _mm_store_ps(result.m[i], row);
+        }
+#else
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                result.m[i][j] = m[i][0] * a.m[0][j] + m[i][1] * a.m[1][j] + m[i][2] * a.m[2][j] + m[i][3] * a.m[3][j];
+#endif
+        return result;
+    }
+
+    Vec4f operator*(const Vec4f& v) const {
+        Vec4f r;
+#ifdef GEOMETRY_SSE2
+        __m128 vv = _mm_load_ps(&v.x);
+        __m128 p0 = _mm_mul_ps(_mm_load_ps(m[0]), vv);
+        __m128 p1 = _mm_mul_ps(_mm_load_ps(m[1]), vv);
+        __m128 p2 = _mm_mul_ps(_mm_load_ps(m[2]), vv);
+        __m128 p3 = _mm_mul_ps(_mm_load_ps(m[3]), vv);
+        // after the transpose p_k holds the k-th products of all four rows
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        _mm_store_ps(&r.x, _mm_add_ps(_mm_add_ps(_mm_add_ps(p0, p1), p2), p3));
+#else
+        for (int i = 0; i < 4; i++)
+            r[i] = m[i][0] * v.x + m[i][1] * v.y + m[i][2] * v.z + m[i][3] * v.w;
+#endif
+        return r;
+    }
+
+    // Point transform (w = 1) followed by the perspective divide
+    Vec3f operator*(const Vec3f& v) const {
+        return ((*this) * Vec4f(v, 1.0f)).project();
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, const Mat4f& m) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                s << m.m[i][j] << "\t";
+            }
+            s << "\n";
+        }
+        return s;
+    }
+};
+
 #endif // GEOMETRY_H
\ No newline at end of file
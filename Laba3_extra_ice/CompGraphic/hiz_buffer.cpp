@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "hiz_buffer.h"
+#include "depth_buffer.h"
+
+HiZBuffer::HiZBuffer() : width_(0), height_(0), blocks_x_(0), blocks_y_(0) {
+}
+
+void HiZBuffer::resize(int width, int height) {
+    width_ = width;
+    height_ = height;
+    blocks_x_ = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blocks_y_ = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    farthest_.resize(blocks_x_ * blocks_y_);
+    dirty_.resize(blocks_x_ * blocks_y_);
+}
+
+void HiZBuffer::build(const float* zbuffer) {
+    for (int b = 0; b < blocks_x_ * blocks_y_; b++) {
+        refresh(b, zbuffer, width_, 0, 0);
+    }
+}
+
+void HiZBuffer::build(const DepthBuffer& depth, float* tile) {
+    // tile by tile, BLOCK_SIZE divides the tile size so no block straddles two
+    const int T = DepthBuffer::TILE_SIZE;
+    for (int ty = 0; ty < depth.tiles_y(); ty++) {
+        for (int tx = 0; tx < depth.tiles_x(); tx++) {
+            int t = tx + ty * depth.tiles_x();
+            bool cleared = depth.tile_cleared(t);
+            if (!cleared) depth.load_tile(t, tile, T);
+            int yend = std::min((ty + 1) * T, height_);
+            int xend = std::min((tx + 1) * T, width_);
+            for (int y = ty * T; y < yend; y += BLOCK_SIZE) {
+                for (int x = tx * T; x < xend; x += BLOCK_SIZE) {
+                    int b = block(x, y);
+                    if (cleared) {
+                        farthest_[b] = DEPTH_CLEAR;
+                        dirty_[b] = 0;
+                    }
+                    else {
+                        refresh(b, tile, T, tx * T, ty * T);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void HiZBuffer::refresh(int b, const float* zbuffer, int stride, int x0, int y0) {
+    int bx = (b % blocks_x_) * BLOCK_SIZE;
+    int by = (b / blocks_x_) * BLOCK_SIZE;
+    int xend = std::min(bx + BLOCK_SIZE, width_);
+    int yend = std::min(by + BLOCK_SIZE, height_);
+    float z = zbuffer[(by - y0) * stride + bx - x0];
+    for (int y = by; y < yend; y++) {
+        const float* row = zbuffer + (y - y0) * stride - x0;
+        for (int x = bx; x < xend; x++) {
+            z = std::min(z, row[x]);
+        }
+    }
+    farthest_[b] = z;
+    dirty_[b] = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef __HIZ_BUFFER_H__
+#define __HIZ_BUFFER_H__
+
+#include <vector>
+
+class DepthBuffer;
+
+// Coarse depth buffer: the farthest depth stored in every 8x8 pixel block.
+// Depth grows towards the camera here, so the farthest value is the minimum.
+// Blocks are refreshed lazily: a depth write that may raise the minimum only
+// marks its block dirty, the next query rescans the 64 pixels.
+class HiZBuffer {
+public:
+	static const int BLOCK_SIZE = 8;
+
+	HiZBuffer();
+	void resize(int width, int height);
+	void build(const float* zbuffer); // full rebuild from a frame-sized zbuffer
+	void build(const DepthBuffer& depth, float* tile); // tile: scratch of DepthBuffer::TILE_SIZE^2 floats
+
+	int block(int x, int y) const { return x / BLOCK_SIZE + (y / BLOCK_SIZE) * blocks_x_; }
+
+	// to be called on every depth write with the value being replaced
+	void on_write(int x, int y, float old_z) {
+		int b = block(x, y);
+		if (old_z <= farthest_[b]) dirty_[b] = 1;
+	}
+
+	// farthest depth of block b; zbuffer/stride/x0/y0 describe whatever
+	// buffer currently holds the block's pixels (frame or tile copy)
+	float farthest(int b, const float* zbuffer, int stride, int x0, int y0) {
+		if (dirty_[b]) refresh(b, zbuffer, stride, x0, y0);
+		return farthest_[b];
+	}
+private:
+	int width_, height_;
+	int blocks_x_, blocks_y_;
+	std::vector<float> farthest_;
+	std::vector<unsigned char> dirty_;
+
+	void refresh(int b, const float* zbuffer, int stride, int x0, int y0);
+};
+
+#endif //__HIZ_BUFFER_H__
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "icosphere.h"
+#include "wireframe.h"
+
+namespace {
+
+// Splits every triangle of indices into four. midpoints maps an edge (smaller
+// vertex index in the high half) to its midpoint vertex, unit vertices only.
+void subdivide(std::vector<Vec3f>& vertices, std::vector<int>& indices,
+    std::unordered_map<unsigned long long, int>& midpoints) {
+    midpoints.clear();
+    auto midpoint = [&](int a, int b) {
+        unsigned long long key = ((unsigned long long)std::min(a, b) << 32) | (unsigned int)std::max(a, b);
+        auto it = midpoints.find(key);
+        if (it != midpoints.end()) return it->second;
+        Vec3f m = vertices[a] + vertices[b];
+        m.normalize();
+        vertices.push_back(m);
+        int idx = (int)vertices.size() - 1;
+        midpoints.emplace(key, idx);
+        return idx;
+    };
+
+    std::vector<int> out;
+    out.reserve(indices.size() * 4);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+        const int tris[12] = { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca };
+        out.insert(out.end(), tris, tris + 12);
+    }
+    indices.swap(out);
+}
+
+SphereMesh* build(int subdivisions, float radius) {
+    SphereMesh* mesh = new SphereMesh();
+    mesh->subdivisions = subdivisions;
+    mesh->radius = radius;
+
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<Vec3f>& v = mesh->vertices;
+    v = {
+        Vec3f(-1,  t,  0), Vec3f(1,  t,  0), Vec3f(-1, -t,  0), Vec3f(1, -t,  0),
+        Vec3f(0, -1,  t), Vec3f(0,  1,  t), Vec3f(0, -1, -t), Vec3f(0,  1, -t),
+        Vec3f(t,  0, -1), Vec3f(t,  0,  1), Vec3f(-t,  0, -1), Vec3f(-t,  0,  1)
+    };
+    for (auto& p : v) p.normalize();
+    mesh->indices = {
+        0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+        1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+        3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+        4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+    };
+
+    // the final vertex count is known up front
+    size_t nverts = 10 * ((size_t)1 << (2 * subdivisions)) + 2;
+    v.reserve(nverts);
+    std::unordered_map<unsigned long long, int> midpoints;
+    midpoints.reserve(nverts);
+    for (int s = 0; s < subdivisions; s++) subdivide(v, mesh->indices, midpoints);
+
+    for (auto& p : v) p = p * radius;
+
+    int nfaces = mesh->nfaces();
+    mesh->normals.resize(nfaces);
+    mesh->centers.resize(nfaces);
+    for (int f = 0; f < nfaces; f++) {
+        const int* idx = mesh->face(f);
+        Vec3f n = (v[idx[1]] - v[idx[0]]) ^ (v[idx[2]] - v[idx[0]]);
+        n.normalize();
+        mesh->normals[f] = n;
+        mesh->centers[f] = (Vec3f(0, 0, 0) + v[idx[0]] + v[idx[1]] + v[idx[2]]) * (1.0f / 3);
+    }
+    mesh->edges = unique_edges(mesh->indices);
+    return mesh;
+}
+
+} // namespace
+
+const SphereMesh& icosphere(int subdivisions, float radius) {
+    static std::mutex mutex;
+    static std::map<std::pair<int, float>, std::unique_ptr<SphereMesh> > cache;
+
+    subdivisions = std::min(MAX_SPHERE_SUBDIVISIONS, std::max(0, subdivisions));
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<SphereMesh>& mesh = cache[std::make_pair(subdivisions, radius)];
+    if (!mesh) mesh.reset(build(subdivisions, radius));
+    return *mesh;
+}
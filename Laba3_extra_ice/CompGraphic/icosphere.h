@@ -0,0 +1,32 @@
+#ifndef __ICOSPHERE_H__
+#define __ICOSPHERE_H__
+
+#include <vector>
+#include "geometry.h"
+
+// Icosahedron subdivided into a sphere. Every step splits each triangle into
+// four at its edge midpoints and pushes the new vertices out onto the sphere;
+// a midpoint is made once and shared by both triangles of its edge.
+// Triangles wind so that (v1 - v0) ^ (v2 - v0) points outwards.
+struct SphereMesh {
+	int subdivisions;
+	float radius;
+	std::vector<Vec3f> vertices;
+	std::vector<int> indices;    // three per triangle
+	std::vector<Vec3f> normals;  // per triangle, unit
+	std::vector<Vec3f> centers;  // per triangle
+	std::vector<int> edges;      // unique_edges(indices), for the outline
+
+	int nfaces() const { return (int)indices.size() / 3; }
+	const int* face(int f) const { return &indices[3 * f]; }
+};
+
+// 20 * 4^subdivisions triangles, 10 * 4^subdivisions + 2 vertices
+const int MAX_SPHERE_SUBDIVISIONS = 7;
+
+// Built on the first request for (subdivisions, radius), the same mesh is
+// returned afterwards. Safe to call from several threads, the mesh lives
+// until exit.
+const SphereMesh& icosphere(int subdivisions, float radius);
+
+#endif //__ICOSPHERE_H__
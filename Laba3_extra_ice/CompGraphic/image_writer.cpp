@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "image_writer.h"
+#include "tgaimage.h"
+
+namespace {
+
+void append(std::vector<unsigned char>& out, const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    out.insert(out.end(), p, p + n);
+}
+
+void append_text(std::vector<unsigned char>& out, const char* text) {
+    append(out, text, strlen(text));
+}
+
+void append_be32(std::vector<unsigned char>& out, unsigned int v) {
+    unsigned char b[4] = { (unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v };
+    append(out, b, 4);
+}
+
+// b, g, r(, a) -> r, g, b(, a) for count pixels
+void to_rgb(const unsigned char* src, int channels, int count, unsigned char* dst, int dst_channels) {
+    for (int i = 0; i < count; i++, src += channels, dst += dst_channels) {
+        if (channels == 1) {
+            dst[0] = src[0];
+            continue;
+        }
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if (dst_channels == 4) dst[3] = src[3];
+    }
+}
+
+// packets as in TGAImage::unload_rle_data
+bool encode_tga(const ImageView& image, std::vector<unsigned char>& out) {
+    if (!image.pixels) return false;
+    int bpp = image.channels;
+    TGA_Header header;
+    memset((void*)&header, 0, sizeof(header));
+    header.bitsperpixel = bpp << 3;
+    header.width = image.width;
+    header.height = image.height;
+    header.datatypecode = bpp == TGAImage::GRAYSCALE ? 11 : 10;
+    header.imagedescriptor = 0x20; // top-left origin
+    append(out, &header, sizeof(header));
+
+    const unsigned char* data = image.pixels;
+    const unsigned long npixels = (unsigned long)image.width * image.height;
+    const unsigned char max_chunk_length = 128;
+    unsigned long curpix = 0;
+    while (curpix < npixels) {
+        unsigned long chunkstart = curpix * bpp;
+        unsigned long curbyte = curpix * bpp;
+        unsigned char run_length = 1;
+        bool raw = true;
+        while (curpix + run_length < npixels && run_length < max_chunk_length) {
+            bool succ_eq = memcmp(data + curbyte, data + curbyte + bpp, bpp) == 0;
+            curbyte += bpp;
+            if (1 == run_length) raw = !succ_eq;
+            if (raw && succ_eq) {
+                run_length--;
+                break;
+            }
+            if (!raw && !succ_eq) break;
+            run_length++;
+        }
+        curpix += run_length;
+        out.push_back(raw ? run_length - 1 : run_length + 127);
+        append(out, data + chunkstart, raw ? run_length * bpp : bpp);
+    }
+
+    const unsigned char refs[8] = { 0 }; // developer and extension area
+    const char footer[18] = "TRUEVISION-XFILE.";
+    append(out, refs, sizeof(refs));
+    append(out, footer, sizeof(footer));
+    return true;
+}
+
+bool encode_ppm(const ImageView& image, std::vector<unsigned char>& out) {
+    if (!image.pixels) return false;
+    int channels = image.channels == 1 ? 1 : 3;
+    char header[64];
+    snprintf(header, sizeof(header), "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, image.width, image.height);
+    append_text(out, header);
+    size_t start = out.size();
+    out.resize(start + (size_t)image.width * image.height * channels);
+    for (int y = 0; y < image.height; y++) {
+        to_rgb(image.pixels + (size_t)y * image.width * image.channels, image.channels, image.width,
+            &out[start + (size_t)y * image.width * channels], channels);
+    }
+    return true;
+}
+
+const unsigned int* crc_table() {
+    static unsigned int table[256];
+    static bool ready = [] {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+unsigned int crc32(const unsigned char* p, size_t n) {
+    const unsigned int* table = crc_table();
+    unsigned int c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; i++) c = table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// length placeholder and type, the data follows; returns where the chunk starts
+size_t begin_chunk(std::vector<unsigned char>& out, const char* type) {
+    size_t start = out.size();
+    append_be32(out, 0);
+    append_text(out, type);
+    return start;
+}
+
+// fills in the length, crc over type and data
+void finish_chunk(std::vector<unsigned char>& out, size_t start) {
+    unsigned int length = (unsigned int)(out.size() - start - 8);
+    for (int i = 0; i < 4; i++) out[start + i] = (unsigned char)(length >> (24 - 8 * i));
+    append_be32(out, crc32(&out[start + 4], out.size() - start - 4));
+}
+
+// zlib stream of stored deflate blocks, filled row by row
+class StoredDeflate {
+public:
+    StoredDeflate(std::vector<unsigned char>& out, size_t total) : out_(out), left_(total), block_left_(0), a_(1), b_(0) {
+        out_.push_back(0x78); // deflate, 32K window
+        out_.push_back(0x01); // no dictionary, fastest
+    }
+    void put(const unsigned char* p, size_t n) {
+        while (n > 0) {
+            if (block_left_ == 0) {
+                block_left_ = std::min(left_, (size_t)65535);
+                unsigned short len = (unsigned short)block_left_, nlen = (unsigned short)~len;
+                unsigned char header[5] = { (unsigned char)(block_left_ == left_ ? 1 : 0),
+                    (unsigned char)len, (unsigned char)(len >> 8), (unsigned char)nlen, (unsigned char)(nlen >> 8) };
+                append(out_, header, 5);
+            }
+            size_t k = std::min(n, block_left_);
+            append(out_, p, k);
+            adler(p, k);
+            block_left_ -= k;
+            left_ -= k;
+            p += k;
+            n -= k;
+        }
+    }
+    void finish() { append_be32(out_, (b_ << 16) | a_); }
+private:
+    std::vector<unsigned char>& out_;
+    size_t left_, block_left_;
+    unsigned int a_, b_;
+
+    void adler(const unsigned char* p, size_t n) {
+        while (n > 0) {
+            // 5552 bytes keep b below 2^32 between the reductions
+            size_t k = std::min(n, (size_t)5552);
+            for (size_t i = 0; i < k; i++) {
+                a_ += p[i];
+                b_ += a_;
+            }
+            a_ %= 65521;
+            b_ %= 65521;
+            p += k;
+            n -= k;
+        }
+    }
+};
+
+bool encode_png(const ImageView& image, std::vector<unsigned char>& out) {
+    if (!image.pixels) return false;
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    append(out, signature, 8);
+
+    size_t start = begin_chunk(out, "IHDR");
+    append_be32(out, image.width);
+    append_be32(out, image.height);
+    const unsigned char color_types[5] = { 0, 0, 0, 2, 6 }; // gray, -, -, RGB, RGBA
+    unsigned char ihdr[5] = { 8, color_types[image.channels], 0, 0, 0 }; // depth, type, deflate, filter, no interlace
+    append(out, ihdr, 5);
+    finish_chunk(out, start);
+
+    start = begin_chunk(out, "IDAT");
+    size_t row_bytes = (size_t)image.width * image.channels;
+    StoredDeflate zlib(out, image.height * (row_bytes + 1));
+    unsigned char chunk[4096];
+    const int chunk_pixels = (int)sizeof(chunk) / 4;
+    for (int y = 0; y < image.height; y++) {
+        const unsigned char filter = 0; // rows go as they are
+        zlib.put(&filter, 1);
+        const unsigned char* row = image.pixels + y * row_bytes;
+        for (int x = 0; x < image.width; x += chunk_pixels) {
+            int n = std::min(chunk_pixels, image.width - x);
+            to_rgb(row + x * image.channels, image.channels, n, chunk, image.channels);
+            zlib.put(chunk, n * image.channels);
+        }
+    }
+    zlib.finish();
+    finish_chunk(out, start);
+
+    start = begin_chunk(out, "IEND");
+    finish_chunk(out, start);
+    return true;
+}
+
+// little-endian (negative scale), rows bottom to top
+bool encode_pfm(const ImageView& image, std::vector<unsigned char>& out) {
+    int channels = image.channels == 1 ? 1 : 3;
+    char header[64];
+    snprintf(header, sizeof(header), "P%c\n%d %d\n-1.0\n", channels == 1 ? 'f' : 'F', image.width, image.height);
+    append_text(out, header);
+    float row[3 * 1024];
+    const int chunk_pixels = 1024;
+    for (int y = image.height - 1; y >= 0; y--) {
+        for (int x0 = 0; x0 < image.width; x0 += chunk_pixels) {
+            int n = std::min(chunk_pixels, image.width - x0);
+            for (int i = 0; i < n; i++) {
+                size_t p = ((size_t)y * image.width + x0 + i) * image.channels;
+                float* dst = row + i * channels;
+                if (image.values) {
+                    for (int k = 0; k < channels; k++) dst[k] = image.values[p + k];
+                }
+                else if (channels == 1) dst[0] = image.pixels[p] / 255.0f;
+                else {
+                    dst[0] = image.pixels[p + 2] / 255.0f;
+                    dst[1] = image.pixels[p + 1] / 255.0f;
+                    dst[2] = image.pixels[p] / 255.0f;
+                }
+            }
+            append(out, row, n * channels * sizeof(float));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+const char* image_extension(ImageFormat format) {
+    const char* extensions[] = { ".tga", ".ppm", ".png", ".pfm" };
+    return extensions[format];
+}
+
+bool encode_image(ImageFormat format, const ImageView& image, std::vector<unsigned char>& out) {
+    switch (format) {
+    case IMAGE_TGA: return encode_tga(image, out);
+    case IMAGE_PPM: return encode_ppm(image, out);
+    case IMAGE_PNG: return encode_png(image, out);
+    case IMAGE_PFM: return encode_pfm(image, out);
+    }
+    return false;
+}
+
+ImageWriter::ImageWriter(int capacity)
+    : queue_(std::max(1, capacity)), head_(0), count_(0), busy_(false), stop_(false),
+      written_(0), bytes_(0), stalls_(0), encode_ms_(0.0), disk_ms_(0.0) {
+    thread_ = std::thread(&ImageWriter::run, this);
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_.notify_one();
+    thread_.join();
+}
+
+void ImageWriter::write(const char* filename, ImageFormat format, const ImageView& image, Done done) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (count_ == queue_.size()) {
+        stalls_++;
+        freed_.wait(lock, [this] { return count_ < queue_.size(); });
+    }
+    Request& r = queue_[(head_ + count_) % queue_.size()];
+    snprintf(r.filename, sizeof(r.filename), "%s", filename);
+    r.format = format;
+    r.image = image;
+    r.done = std::move(done);
+    count_++;
+    lock.unlock();
+    queued_.notify_one();
+}
+
+void ImageWriter::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return count_ == 0 && !busy_; });
+}
+
+void ImageWriter::run() {
+    Request r;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this] { return count_ > 0 || stop_; });
+            if (count_ == 0) return; // stopping, nothing left
+            Request& front = queue_[head_];
+            memcpy(r.filename, front.filename, sizeof(r.filename));
+            r.format = front.format;
+            r.image = front.image;
+            r.done = std::move(front.done);
+            head_ = (head_ + 1) % queue_.size();
+            count_--;
+            busy_ = true;
+        }
+        freed_.notify_one();
+
+        auto encode_start = std::chrono::steady_clock::now();
+        buffer_.clear();
+        bool ok = encode_image(r.format, r.image, buffer_);
+        auto disk_start = std::chrono::steady_clock::now();
+        if (ok) {
+            // one write for the whole file
+            std::ofstream out;
+            out.rdbuf()->pubsetbuf(stream_buffer_, sizeof(stream_buffer_));
+            out.open(r.filename, std::ios::binary);
+            out.write((const char*)buffer_.data(), buffer_.size());
+            ok = out.good();
+            if (!ok) std::cerr << "can't write " << r.filename << "\n";
+        }
+        auto disk_end = std::chrono::steady_clock::now();
+        if (r.done) r.done(r.filename, ok);
+        r.done = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_ = false;
+            if (ok) {
+                written_++;
+                bytes_ += (long long)buffer_.size();
+            }
+            encode_ms_ += std::chrono::duration<double, std::milli>(disk_start - encode_start).count();
+            disk_ms_ += std::chrono::duration<double, std::milli>(disk_end - disk_start).count();
+        }
+        idle_.notify_all();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef __IMAGE_WRITER_H__
+#define __IMAGE_WRITER_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum ImageFormat {
+	IMAGE_TGA,  // RLE, same bytes as TGAImage::write_tga_file
+	IMAGE_PPM,  // binary P6, P5 for grayscale
+	IMAGE_PNG,  // 8-bit, deflate with stored blocks only, so no zlib is needed
+	IMAGE_PFM   // 32-bit float, PF or Pf for one channel
+};
+
+const char* image_extension(ImageFormat format); // ".tga", ...
+
+// Pixels handed to an encoder, rows top to bottom as in the render targets.
+// 8-bit pixels are b, g, r(, a) like TGAImage; float pixels are one value
+// (channels == 1) or r, g, b. Exactly one of pixels and values is set.
+struct ImageView {
+	int width, height;
+	int channels;                 // 1, 3 or 4
+	const unsigned char* pixels;
+	const float* values;
+};
+
+// Appends the whole file to out. False if the format can't hold the image
+// (float data as TGA/PPM/PNG); 8-bit data goes to PFM scaled to 0..1.
+bool encode_image(ImageFormat format, const ImageView& image, std::vector<unsigned char>& out);
+
+// Encodes and writes images on its own thread. write() only queues the request;
+// it blocks while the queue is full, so a renderer faster than the disk is held
+// back by at most capacity frames instead of by every write.
+// The pixels must stay untouched until done is called, which happens on the
+// writer thread after the file is closed.
+class ImageWriter {
+public:
+	typedef std::function<void(const char* filename, bool ok)> Done;
+
+	explicit ImageWriter(int capacity = 4);
+	~ImageWriter(); // writes what is still queued
+	void write(const char* filename, ImageFormat format, const ImageView& image, Done done);
+	void wait();    // until the queue is empty and the last file is written
+
+	int capacity() const { return (int)queue_.size(); }
+	// totals, read after wait()
+	int written() const { return written_; }
+	long long bytes() const { return bytes_; }
+	int stalls() const { return stalls_; }        // write() calls that found the queue full
+	double encode_ms() const { return encode_ms_; }
+	double disk_ms() const { return disk_ms_; }
+private:
+	struct Request {
+		char filename[256];
+		ImageFormat format;
+		ImageView image;
+		Done done;
+	};
+	std::vector<Request> queue_;  // ring of capacity slots
+	size_t head_, count_;
+	bool busy_, stop_;
+	std::mutex mutex_;
+	std::condition_variable queued_, freed_, idle_;
+	std::vector<unsigned char> buffer_;  // encoded file, reused
+	char stream_buffer_[4096];           // for the ofstream, which would allocate its own on every open
+	int written_;
+	long long bytes_;
+	int stalls_;
+	double encode_ms_, disk_ms_;
+	std::thread thread_;
+
+	void run();
+};
+
+#endif //__IMAGE_WRITER_H__
@@ -0,0 +1,110 @@
+#include "job_system.h"
+
+namespace {
+thread_local const JobSystem* tls_owner = nullptr;
+thread_local int tls_worker = 0;
+}
+
+JobSystem::JobSystem(int nthreads) : queued_(0), pending_(0), stop_(false) {
+    if (nthreads <= 0) nthreads = (int)std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+    for (int i = 0; i < nthreads; i++) {
+        queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int i = 1; i < nthreads; i++) {
+        threads_.push_back(std::thread(&JobSystem::worker_loop, this, i));
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void JobSystem::Queue::push_back(Job job) {
+    if (count == ring.size()) {
+        std::vector<Job> grown(ring.size() * 2);
+        for (size_t i = 0; i < count; i++) grown[i] = std::move(ring[(head + i) % ring.size()]);
+        ring.swap(grown);
+        head = 0;
+    }
+    ring[(head + count) % ring.size()] = std::move(job);
+    count++;
+}
+
+JobSystem::Job JobSystem::Queue::pop_back() {
+    count--;
+    return std::move(ring[(head + count) % ring.size()]);
+}
+
+JobSystem::Job JobSystem::Queue::pop_front() {
+    Job job = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    count--;
+    return job;
+}
+
+void JobSystem::submit(Job job) {
+    pending_++;
+    Queue& q = tls_owner == this ? *queues_[tls_worker] : inbox_;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_++;
+    }
+    wake_.notify_all();
+}
+
+bool JobSystem::run_one(int worker) {
+    Job job;
+    int n = size();
+    // own queue from the back (most recent, still warm), then the oldest job
+    // submitted from outside, then steal the oldest job of the others
+    for (int k = 0; k <= n && !job; k++) {
+        Queue& q = k == 0 ? *queues_[worker] : k == 1 ? inbox_ : *queues_[(worker + k - 1) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.count == 0) continue;
+        job = k == 0 ? q.pop_back() : q.pop_front();
+    }
+    if (!job) return false;
+    queued_--;
+
+    job(worker);
+
+    if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_all();
+    }
+    return true;
+}
+
+void JobSystem::worker_loop(int worker) {
+    tls_owner = this;
+    tls_worker = worker;
+    for (;;) {
+        if (run_one(worker)) continue;
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_) return;
+    }
+}
+
+void JobSystem::wait() {
+    // worker 0 only while inside, later submits from this thread are from outside again
+    const JobSystem* owner = tls_owner;
+    tls_owner = this;
+    tls_worker = 0;
+    while (pending_ > 0) {
+        if (run_one(0)) continue;
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return pending_ == 0 || queued_ > 0; });
+    }
+    tls_owner = owner;
+}
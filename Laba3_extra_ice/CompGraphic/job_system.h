@@ -0,0 +1,53 @@
+#ifndef __JOB_SYSTEM_H__
+#define __JOB_SYSTEM_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job system for coarse independent tasks (whole views, file writes).
+// Every worker owns a deque: it pushes and pops its own jobs at the back, idle
+// workers steal from the front of the others. Jobs submitted from outside the
+// workers go to a shared queue that is taken in submission order, after a
+// worker's own jobs and before stealing. The thread calling wait() works too
+// and always gets worker index 0. Jobs may submit more jobs.
+class JobSystem {
+public:
+	typedef std::function<void(int worker)> Job;
+
+	JobSystem(int nthreads = 0); // 0 - one worker per hardware thread
+	~JobSystem();
+	int size() const { return (int)queues_.size(); }
+	void submit(Job job);
+	void wait(); // runs jobs until every submitted job (and what they submitted) is done
+private:
+	// Ring of jobs that doubles when full and never shrinks, so once it has
+	// grown to the deepest queue seen, submitting stops allocating
+	struct Queue {
+		std::mutex mutex;
+		std::vector<Job> ring;
+		size_t head, count;
+
+		Queue() : ring(8), head(0), count(0) {}
+		void push_back(Job job);
+		Job pop_back();
+		Job pop_front();
+	};
+	std::vector<std::unique_ptr<Queue> > queues_;
+	Queue inbox_;  // submitted from outside the workers
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::atomic<int> queued_;   // jobs sitting in queues
+	std::atomic<int> pending_;  // jobs submitted and not finished
+	bool stop_;
+
+	bool run_one(int worker);
+	void worker_loop(int worker);
+};
+
+#endif //__JOB_SYSTEM_H__
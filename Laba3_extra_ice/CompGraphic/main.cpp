@@ -4,366 +4,569 @@
 #include <limits>  
 #include <iostream>
 #include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <cstdio>
+#include <functional>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
 #include "camera.h"
+#include "renderer.h"
+#include "vertex_cache.h"
+#include "job_system.h"
+#include "shader.h"
+#include "shadow_map.h"
+#include "icosphere.h"
+#include "wireframe.h"
+#include "alloc_stats.h"
+#include "image_writer.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
 const TGAColor green = TGAColor(0, 255, 0, 255);
 const TGAColor ice_color = TGAColor(180, 240, 255, 100);
 const TGAColor sphere_outline = TGAColor(150, 200, 255, 200);
+// Допуск теста глубины контура: ребро лежит на грани, которая уже записала ту же глубину
+const float outline_depth_bias = 1e-4f;
+// Верхняя граница --abuffer-mb: пул фрагментов выделяется целиком
+const int max_abuffer_mb = 4096;
 
 Model* model = NULL;
 const int width = 800;
 const int height = 800;
 
-TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg) {
-    float alpha = fg.a / 255.0f;
-
-    unsigned char r = static_cast<unsigned char>(bg.r * (1.0f - alpha) + fg.r * alpha);
-    unsigned char g = static_cast<unsigned char>(bg.g * (1.0f - alpha) + fg.g * alpha);
-    unsigned char b = static_cast<unsigned char>(bg.b * (1.0f - alpha) + fg.b * alpha);
-
-    return TGAColor(r, g, b, 255);
+// Направленный свет, общий для всех видов
+const Vec3f light_direction(0.2f, 0.4f, -1.0f);
+const float material_specular = 0.4f;
+const float shininess = 32.0f;
+
+// Позиции вершин заполняет Renderer::draw после отсечения, varyings - вершинный шейдер
+TriangleCmd make_triangle(ShaderKind shader, float intensity, TGAColor color, Model* model, bool cull_back) {
+    TriangleCmd tri;
+    tri.nvaryings = 0;
+    tri.intensity = intensity;
+    tri.is_transparent = shader == SHADER_ICE;
+    tri.color = color;
+    tri.model = model;
+    tri.cull_back = cull_back;
+    tri.shader = shader;
+    tri.sampler.filter = FILTER_POINT;
+    tri.sampler.wrap = WRAP_CLAMP;
+    tri.lighting = nullptr;
+    return tri;
 }
 
-//Line Sweeping
-void triangle(Vec3i t0, Vec3i t1, Vec3i t2, Vec2i uv0, Vec2i uv1, Vec2i uv2,
-    TGAImage& image, float intensity, float* zbuffer,
-    bool is_transparent = false, TGAColor transparent_color = TGAColor(255, 255, 255, 255),
-    Model* model = nullptr) {
-
-    if (t0.y < 0 && t1.y < 0 && t2.y < 0) return;
-    if (t0.y >= height && t1.y >= height && t2.y >= height) return;
-    if (t0.x < 0 && t1.x < 0 && t2.x < 0) return;
-    if (t0.x >= width && t1.x >= width && t2.x >= width) return;
+// Лицевая ли грань f сферы для камеры в eye
+bool sphere_face_front(const SphereMesh& sphere, int f, const Vec3f& eye) {
+    Vec3f to_camera = eye - sphere.centers[f];
+    to_camera.normalize();
+    return sphere.normals[f] * to_camera > 0.0f;
+}
 
-    if (t0.y == t1.y && t0.y == t2.y) return;
+// Рендеринг задних граней сферы
+void render_sphere_with_layers(Camera& camera, const SphereMesh& mesh, VertexCache& sphere, Renderer& renderer, Vec3f light_dir) {
+    Vec3f eye = camera.getEye();
+    for (int f = 0; f < mesh.nfaces(); f++) {
+        if (!sphere_face_front(mesh, f, eye)) { // Рендерим только невидимые (задние) грани
+            // Освещение для грани сферы
+            float intensity = 0.6f + 0.2f * std::abs(mesh.normals[f] * light_dir);
+            intensity = std::min(0.8f, std::max(0.5f, intensity));
 
-    if (t0.y > t1.y) { std::swap(t0, t1); std::swap(uv0, uv1); }
-    if (t0.y > t2.y) { std::swap(t0, t2); std::swap(uv0, uv2); }
-    if (t1.y > t2.y) { std::swap(t1, t2); std::swap(uv1, uv2); }
+            renderer.draw(sphere, mesh.face(f), make_triangle(SHADER_FLAT, intensity, ice_color, nullptr, false));
+        }
+    }
+}
 
-    int total_height = t2.y - t0.y;
+// Рендеринг передних (прозрачных) граней сферы
+void render_front_sphere_faces(Camera& camera, const SphereMesh& mesh, VertexCache& sphere, Renderer& renderer, Vec3f light_dir) {
+    Vec3f eye = camera.getEye();
+    for (int f = 0; f < mesh.nfaces(); f++) {
+        if (sphere_face_front(mesh, f, eye)) { // Рендерим только видимые (передние) грани
+            // Освещение для передней грани сферы
+            float intensity = 0.5f + 0.3f * std::abs(mesh.normals[f] * light_dir);
+            intensity = std::min(0.7f, std::max(0.4f, intensity));
 
-    for (int y = t0.y; y <= t2.y; y++) {
-        if (y < 0 || y >= height) continue;
+            // Рендерим как прозрачную грань
+            renderer.draw(sphere, mesh.face(f), make_triangle(SHADER_ICE, intensity, ice_color, nullptr, false));
+        }
+    }
+}
 
-        bool second_half = y > t1.y || t1.y == t0.y;
-        int segment_height = second_half ? t2.y - t1.y : t1.y - t0.y;
-        if (segment_height == 0) segment_height = 1;
+struct ViewConfig {
+    std::string name;
+    Vec3f eye;
+    Vec3f target;
+    Vec3f up;
+    float fov;
+};
 
-        float alpha = (float)(y - t0.y) / total_height;
-        float beta = second_half ? (float)(y - t1.y) / segment_height : (float)(y - t0.y) / segment_height;
+struct RenderSettings {
+    bool tiled;
+    bool hiz;
+    bool deferred;
+    TransparencyMode transparency;
+    int abuffer_mb;
+    int samples;
+    DepthFormat depth_format;
+    bool depth_compression;
+    Sampler sampler;
+    ShaderKind shading;  // головы
+    int threads;
+    RasterMode mode;
+    bool shadows;
+    int shadow_size;
+    int sphere_subdivisions;
+    bool outline_depth;
+};
 
-        int xA = t0.x + (t2.x - t0.x) * alpha;
-        int xB = second_half ? t1.x + (t2.x - t1.x) * beta : t0.x + (t1.x - t0.x) * beta;
+// Буферы одного воркера, переиспользуются между видами
+struct ViewContext {
+    Renderer renderer;
+    VertexCache model_cache;
+    VertexCache sphere_cache;
+    DepthBuffer depth;
+    Sampler sampler;
+    ShaderKind shading;
+    bool outline_depth;
+    std::stringstream log;           // отчёт вида, буфер переиспользуется
+
+    ViewContext(const RenderSettings& settings, const std::vector<Vec3f>& model_positions,
+        const SphereMesh& sphere)
+        : renderer(width, height, settings.tiled, settings.mode, settings.threads),
+          depth(width, height, settings.depth_format, settings.depth_compression), sampler(settings.sampler),
+          shading(settings.shading), outline_depth(settings.outline_depth) {
+        renderer.set_hiz(settings.hiz);
+        renderer.set_deferred(settings.deferred);
+        renderer.set_transparency(settings.transparency);
+        renderer.set_abuffer_limit((size_t)settings.abuffer_mb << 20);
+        renderer.set_samples(settings.samples);
+        model_cache.load(model_positions);
+        sphere_cache.load(sphere.vertices);
+    }
+};
 
-        float zA = t0.z + (t2.z - t0.z) * alpha;
-        float zB = second_half ? t1.z + (t2.z - t1.z) * beta : t0.z + (t1.z - t0.z) * beta;
+// Цвет вида и, если глубина сохраняется, расстояния до камеры
+struct RenderTarget {
+    ColorBuffer color;
+    std::vector<float> depth;
 
-        Vec2i uvA = uv0 + (uv2 - uv0) * alpha;
-        Vec2i uvB = second_half ? uv1 + (uv2 - uv1) * beta : uv0 + (uv1 - uv0) * beta;
+    RenderTarget() : color(width, height, TGAImage::RGB) {}
+};
 
-        if (xA > xB) {
-            std::swap(xA, xB);
-            std::swap(zA, zB);
-            std::swap(uvA, uvB);
+// Цели рендера для видов: вид берёт свободную, запись файла возвращает её.
+// Новая создаётся, только если все заняты
+class TargetPool {
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<RenderTarget> > targets_;
+    std::vector<RenderTarget*> free_;
+public:
+    RenderTarget* acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            targets_.push_back(std::unique_ptr<RenderTarget>(new RenderTarget()));
+            return targets_.back().get();
         }
+        RenderTarget* target = free_.back();
+        free_.pop_back();
+        return target;
+    }
+    void release(RenderTarget* target) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(target);
+    }
+    int size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return (int)targets_.size();
+    }
+};
 
-        for (int x = xA; x <= xB; x++) {
-            if (x < 0 || x >= width) continue;
-
-            float phi = (xA == xB) ? 1.0f : (float)(x - xA) / (float)(xB - xA);
-
-            float z = zA + (zB - zA) * phi;
-            Vec2i uv = uvA + (uvB - uvA) * phi;
+// Рендерит один вид в color, сообщения пишет в log. Возвращает время растеризации в мс.
+// shadow - общая для всех видов карта теней головы или NULL
+// sphere - ледяная сфера, та же, что загружена в ctx.sphere_cache
+// depth_out - NULL или width * height расстояний от камеры вдоль взгляда, фон - дальняя плоскость
+double render_view(const ViewConfig& config, ViewContext& ctx, const SphereMesh& sphere, const ShadowMap* shadow,
+    ColorBuffer& color, float* depth_out, std::ostream& log) {
+    Vec3f light_dir = light_direction;
+    light_dir.normalize();
 
-            int idx = x + y * width;
+    log << "\n=== Rendering " << config.name << " view... ===" << std::endl;
+
+    Camera camera(config.eye, config.target, config.up,
+        config.fov, (float)width / height, 0.1f, 100.0f);
+
+    Renderer& renderer = ctx.renderer;
+    VertexCache& model_cache = ctx.model_cache;
+    VertexCache& sphere_cache = ctx.sphere_cache;
+    DepthBuffer& depth = ctx.depth;
+    depth.set_range(camera.getNdcDepth(camera.getZFar()), camera.getNdcDepth(camera.getZNear()));
+    depth.clear();
+    color.clear(TGAColor(0, 0, 0));
+
+    // освещение для шейдеров головы, живёт до flush
+    Lighting lighting;
+    lighting.light_dir = light_dir;
+    lighting.eye = camera.getEye();
+    lighting.ambient = 0.25f;
+    lighting.specular = material_specular;
+    lighting.shininess = (int)shininess;
+    lighting.shadow = shadow;
+
+    auto view_start = std::chrono::steady_clock::now();
+    Mat4f viewProj = camera.getViewProjectionMatrix();
+    model_cache.begin(viewProj, width, height, camera.getZNear());
+    sphere_cache.begin(viewProj, width, height, camera.getZNear());
+    renderer.begin(color, depth);
+
+    log << "1. Rendering back faces of sphere... ";
+    render_sphere_with_layers(camera, sphere, sphere_cache, renderer, light_dir);
+    log << "Done" << std::endl;
+
+    log << "2. Rendering object inside sphere... ";
+
+    int rendered_faces = 0;
+    int total_faces = model->nfaces();
+
+    // Рендерим объект (голову)
+    for (int i = 0; i < total_faces; i++) {
+        if (i % (total_faces / 50) == 0) {
+            log << ".";
+        }
 
-            if (is_transparent) {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
+        if (model->face_size(i) < 3) continue;
 
-                    TGAColor color_with_intensity = transparent_color;
-                    color_with_intensity.r = (unsigned char)(transparent_color.r * intensity);
-                    color_with_intensity.g = (unsigned char)(transparent_color.g * intensity);
-                    color_with_intensity.b = (unsigned char)(transparent_color.b * intensity);
+        int idx[3];
+        Vec3f world_coords[3];
+        ShaderVertex vertices[3];
+        bool valid = true;
 
-                    TGAColor current_color = image.get(x, y);
-                    TGAColor blended = blend_colors(current_color, color_with_intensity);
-                    image.set(x, y, blended);
-                }
+        for (int j = 0; j < 3; j++) {
+            idx[j] = model->vert_index(i, j);
+            if (idx[j] < 0 || idx[j] >= model->nverts()) {
+                valid = false;
+                break;
             }
-            else if (model) {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
-
-                    TGAColor color = model->diffuse(uv);
-                    color.r = (unsigned char)(color.r * intensity);
-                    color.g = (unsigned char)(color.g * intensity);
-                    color.b = (unsigned char)(color.b * intensity);
 
-                    image.set(x, y, color);
-                }
+            world_coords[j] = model_cache.position(idx[j]);
+            vertices[j].position = world_coords[j];
+            vertices[j].uv = model->uv(i, j);
+            if (ctx.shading == SHADER_GOURAUD || ctx.shading == SHADER_PHONG) {
+                vertices[j].normal = model->normal(i, j);
+                vertices[j].tangent = model->tangent(i, j);
             }
-            else {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
-
-                    TGAColor color = transparent_color;
-                    color.r = (unsigned char)(transparent_color.r * intensity);
-                    color.g = (unsigned char)(transparent_color.g * intensity);
-                    color.b = (unsigned char)(transparent_color.b * intensity);
+        }
 
-                    image.set(x, y, color);
-                }
+        if (!valid) continue;
+
+        Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
+        float norm = n.norm();
+        if (norm > 0) {
+            n.normalize();
+
+            Vec3f view_dir = (camera.getEye() - world_coords[0]);
+            view_dir.normalize();
+
+            Vec3f light_dir_neg = light_dir * (-1.0f);
+            Vec3f reflect_dir = light_dir_neg.reflect(n);
+            reflect_dir.normalize();
+
+            float ambient = 0.25f;
+            float diffuse = std::abs(n * light_dir);
+            float specular = material_specular * std::pow(std::max(0.0f, view_dir * reflect_dir), shininess);
+
+            float intensity = ambient + diffuse + specular;
+            intensity = std::min(1.0f, std::max(0.0f, intensity));
+
+            if (intensity > 0.0f) {
+                rendered_faces++;
+                TriangleCmd tri = make_triangle(ctx.shading, intensity, white, model, true);
+                tri.sampler = ctx.sampler;
+                tri.lighting = &lighting;
+                with_shader(ctx.shading, [&](auto tag) {
+                    typedef typename decltype(tag)::type Shader;
+                    for (int j = 0; j < 3; j++) tri.nvaryings = Shader::vertex(vertices[j], lighting, tri.varyings[j]);
+                });
+                renderer.draw(model_cache, idx, tri);
             }
         }
     }
-}
 
-// Генерация вершин сферы (икосаэдра для простоты, можно использовать более детализированную сферу)
-std::vector<Vec3f> generate_sphere_vertices(int subdivisions = 2, float radius = 1.4f) {
-    std::vector<Vec3f> vertices;
+    log << " Done" << std::endl;
 
-    // Начинаем с икосаэдра
-    const float t = (1.0f + sqrt(5.0f)) / 2.0f;
+    log << "3. Rendering front (transparent) faces of sphere... ";
+    render_front_sphere_faces(camera, sphere, sphere_cache, renderer, light_dir);
+    renderer.flush();
+    log << "Done" << std::endl;
 
-    vertices = {
-        Vec3f(-1,  t,  0), Vec3f(1,  t,  0), Vec3f(-1, -t,  0), Vec3f(1, -t,  0),
-        Vec3f(0, -1,  t), Vec3f(0,  1,  t), Vec3f(0, -1, -t), Vec3f(0,  1, -t),
-        Vec3f(t,  0, -1), Vec3f(t,  0,  1), Vec3f(-t,  0, -1), Vec3f(-t,  0,  1)
-    };
+    double view_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - view_start).count();
 
-    // Нормализуем и масштабируем
-    for (auto& v : vertices) {
-        v.normalize();
-        v = v * radius;
+    log << "4. Rendering sphere outline... ";
+    float* outline_z = nullptr;
+    if (ctx.outline_depth) {
+        // кадр уже сведён, арена рендерера свободна до следующего begin
+        outline_z = renderer.arena().alloc<float>(width * height);
+        depth.load(outline_z);
     }
-
-    return vertices;
-}
-
-// Структура для грани сферы
-struct SphereFace {
-    std::vector<int> indices;
-    bool is_front;
-    Vec3f normal;
-    Vec3f center;
-};
-
-// Расчет нормали грани
-Vec3f calculate_face_normal(const std::vector<Vec3f>& vertices, const std::vector<int>& indices) {
-    if (indices.size() < 3) return Vec3f(0, 0, 1);
-
-    Vec3f v0 = vertices[indices[0]];
-    Vec3f v1 = vertices[indices[1]];
-    Vec3f v2 = vertices[indices[2]];
-
-    Vec3f normal = (v2 - v0) ^ (v1 - v0);
-    normal.normalize();
-    return normal;
-}
-
-// Получение граней сферы с определением видимости
-std::vector<SphereFace> get_sphere_faces(const Camera& camera, const std::vector<Vec3f>& sphere_vertices) {
-    std::vector<SphereFace> faces;
-
-    // Базовые грани икосаэдра (20 граней)
-    std::vector<std::vector<int>> base_faces = {
-        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
-        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
-        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
-        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
-    };
-
-    Vec3f camera_pos = camera.getEye();
-
-    for (const auto& face_indices : base_faces) {
-        SphereFace sphere_face;
-        sphere_face.indices = face_indices;
-
-        // Расчет нормали грани
-        sphere_face.normal = calculate_face_normal(sphere_vertices, face_indices);
-
-        // Расчет центра грани
-        sphere_face.center = Vec3f(0, 0, 0);
-        for (int idx : face_indices) {
-            sphere_face.center = sphere_face.center + sphere_vertices[idx];
+    WireStats wire;
+    draw_wireframe(sphere_cache.verts(), sphere.edges, sphere_outline, color, outline_z, outline_depth_bias, wire);
+    log << "Done" << std::endl;
+
+    if (depth_out) {
+        // обратно из NDC: z = p22 - p23 / d
+        depth.load(depth_out);
+        Mat4f proj = camera.getProjectionMatrix();
+        float zfar = camera.getZFar();
+        for (int i = 0; i < width * height; i++) {
+            float z = depth_out[i];
+            depth_out[i] = z == DEPTH_CLEAR ? zfar : std::min(zfar, proj[2][3] / (proj[2][2] - z));
         }
-        sphere_face.center = sphere_face.center * (1.0f / face_indices.size());
-
-        // Определение видимости (лицевые грани)
-        Vec3f to_camera = camera_pos - sphere_face.center;
-        to_camera.normalize();
-
-        float dot_product = sphere_face.normal * to_camera;
-        sphere_face.is_front = (dot_product > 0.0f); // Все грани с положительным скалярным произведением видимы
+    }
 
-        faces.push_back(sphere_face);
+    log << "Faces rendered: " << rendered_faces << "/" << total_faces << std::endl;
+    log << "Raster time: " << view_ms << " ms" << std::endl;
+    log << "Outline: " << wire.edges << " edges, " << wire.drawn << " drawn, " << wire.pixels << " px"
+        << (ctx.outline_depth ? " (depth tested)" : "") << std::endl;
+    log << "Vertex cache: " << model_cache.transforms() << " transforms, "
+        << model_cache.lookups() << " lookups, hit rate "
+        << model_cache.hit_rate() * 100.0f << "%" << std::endl;
+    const ClipStats& clip = renderer.clip_stats();
+    RasterStats raster = renderer.raster_stats();
+    log << "Clipping: " << clip.triangles << " triangles, " << clip.accepted << " accepted, "
+        << clip.clipped << " clipped, " << clip.rejected << " rejected" << std::endl;
+    log << "Culling: " << clip.culled << " back faces, " << clip.degenerate << " degenerate, "
+        << raster.hiz_triangles << " hi-Z triangles, " << raster.hiz_blocks << " hi-Z blocks" << std::endl;
+    log << "Shaded pixels: " << raster.shaded << (renderer.deferred() ? " (deferred)" : "") << std::endl;
+    const FrameArena& arena = renderer.arena();
+    log << "Frame arena: " << arena.used() / 1024 << " KB used, peak " << arena.peak() / 1024 << " KB, "
+        << arena.capacity() / 1024 << " KB in "
+        << arena.blocks() << (arena.blocks() == 1 ? " block" : " blocks") << std::endl;
+    if (renderer.transparency() == TRANSPARENCY_ABUFFER) {
+        const ABuffer& ab = renderer.abuffer();
+        log << "A-buffer: " << ab.used() << "/" << ab.capacity() << " fragments, "
+            << ab.overflow() << " overflowed" << std::endl;
     }
+    int cleared, plane, raw;
+    depth.tile_counts(cleared, plane, raw);
+    log << "Depth: " << (depth.bytes_read() + depth.bytes_written()) / 1024 << " KB moved, "
+        << (double)(depth.bytes_read() + depth.bytes_written()) / (width * height) << " B/px, tiles "
+        << cleared << " cleared, " << plane << " plane, " << raw << " raw" << std::endl;
 
-    return faces;
+    return view_ms;
 }
 
-// Рендеринг задних граней сферы
-void render_sphere_with_layers(Camera& camera, TGAImage& image, float* zbuffer, Vec3f light_dir) {
-    std::vector<Vec3f> sphere_vertices = generate_sphere_vertices();
-    std::vector<SphereFace> faces = get_sphere_faces(camera, sphere_vertices);
-
-    for (const auto& face : faces) {
-        if (!face.is_front) { // Рендерим только невидимые (задние) грани
-            Vec3i screen_coords[3];
-            Vec3f world_coords[3];
-
-            for (int j = 0; j < 3; j++) {
-                int idx = face.indices[j];
-                Vec3f v = sphere_vertices[idx];
-                world_coords[j] = v;
-
-                Matrix viewProj = camera.getViewProjectionMatrix();
-                Vec3f transformed = viewProj * v;
-
-                screen_coords[j] = Vec3i(
-                    (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                    (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                    (int)(transformed.z * 1000.0f)
-                );
-            }
-
-            // Освещение для грани сферы
-            float intensity = 0.6f + 0.2f * std::abs(face.normal * light_dir);
-            intensity = std::min(0.8f, std::max(0.5f, intensity));
-
-            triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                Vec2i(0, 0), Vec2i(0, 0), Vec2i(0, 0),
-                image, intensity, zbuffer, false, ice_color, nullptr);
-        }
+// Скорость выборок из текстуры в линейном, блочном 4x4 и Morton-порядке: экранная сетка
+// N x N проходит текстуру под разными углами и с разным шагом. Трилинейно с
+// уровнем по шагу и билинейно из нулевого уровня, как выборка без мипов
+void run_texture_benchmark(const char* filename) {
+    TGAImage image;
+    if (!image.read_tga_file(filename)) {
+        std::cout << "ERROR: can't read " << filename << std::endl;
+        return;
     }
-}
-
-// Рендеринг передних (прозрачных) граней сферы
-void render_front_sphere_faces(Camera& camera, TGAImage& image, float* zbuffer, Vec3f light_dir) {
-    std::vector<Vec3f> sphere_vertices = generate_sphere_vertices();
-    std::vector<SphereFace> faces = get_sphere_faces(camera, sphere_vertices);
-
-    for (const auto& face : faces) {
-        if (face.is_front) { // Рендерим только видимые (передние) грани
-            Vec3i screen_coords[3];
-            Vec3f world_coords[3];
-
-            for (int j = 0; j < 3; j++) {
-                int idx = face.indices[j];
-                Vec3f v = sphere_vertices[idx];
-                world_coords[j] = v;
-
-                Matrix viewProj = camera.getViewProjectionMatrix();
-                Vec3f transformed = viewProj * v;
-
-                screen_coords[j] = Vec3i(
-                    (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                    (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                    (int)(transformed.z * 1000.0f)
-                );
+    image.flip_vertically();
+    const int nlayouts = 3;
+    Texture2D textures[nlayouts];
+    textures[0].load(image, TEXTURE_LINEAR);
+    textures[1].load(image, TEXTURE_TILED);
+    textures[2].load(image, TEXTURE_MORTON);
+
+    const int N = 512;
+    const int repeats = 3;
+    const float angles[] = { 0.0f, 30.0f, 90.0f };
+    const float steps[] = { 1.0f, 2.0f, 4.0f };  // текселей на пиксель
+    Sampler samplers[2] = { { FILTER_TRILINEAR, WRAP_REPEAT }, { FILTER_BILINEAR, WRAP_REPEAT } };
+    float w = (float)textures[0].width(), h = (float)textures[0].height();
+
+    std::cout << "Texture fetch benchmark: " << filename << " " << (int)w << "x" << (int)h << ", "
+        << N << "x" << N << " samples, Msamples/s" << std::endl;
+    std::cout << "                      trilinear                   level 0" << std::endl;
+    std::cout << "angle step   linear    tiled   morton   linear    tiled   morton" << std::endl;
+    unsigned int checksum = 0;
+    for (float angle : angles) {
+        float c = std::cos(angle * 3.14159265f / 180.0f), s = std::sin(angle * 3.14159265f / 180.0f);
+        for (float step : steps) {
+            double rate[2 * nlayouts];
+            for (int k = 0; k < 2 * nlayouts; k++) {
+                const Texture2D& tex = textures[k % nlayouts];
+                const Sampler& sampler = samplers[k / nlayouts];
+                float lod = k < nlayouts ? std::log2(step) : 0.0f;
+                double best = 1e30;
+                for (int r = 0; r < repeats; r++) {
+                    auto start = std::chrono::steady_clock::now();
+                    for (int j = 0; j < N; j++) {
+                        for (int i = 0; i < N; i++) {
+                            float x = (i - N / 2) * step, y = (j - N / 2) * step;
+                            float u = 0.5f + (c * x - s * y) / w;
+                            float v = 0.5f + (s * x + c * y) / h;
+                            checksum += tex.sample(sampler, u, v, lod).val;
+                        }
+                    }
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                }
+                rate[k] = N * N / best / 1e6;
             }
-
-            // Освещение для передней грани сферы
-            float intensity = 0.5f + 0.3f * std::abs(face.normal * light_dir);
-            intensity = std::min(0.7f, std::max(0.4f, intensity));
-
-            // Рендерим как прозрачную грань
-            triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                Vec2i(0, 0), Vec2i(0, 0), Vec2i(0, 0),
-                image, intensity, zbuffer, true, ice_color, nullptr);
+            printf("%5.0f %4.0f", angle, step);
+            for (int k = 0; k < 2 * nlayouts; k++) printf(" %8.1f", rate[k]);
+            printf("\n");
         }
     }
+    std::cout << "checksum " << checksum << std::endl;
 }
 
-// Дополнительная функция для рендеринга контура сферы
-void render_sphere_outline(Camera& camera, TGAImage& image, float* zbuffer) {
-    std::vector<Vec3f> sphere_vertices = generate_sphere_vertices();
-
-    // Рисуем рёбра сферы (контур)
-    std::vector<std::pair<int, int>> edges = {
-        {0, 11}, {11, 5}, {5, 0}, {0, 5}, {5, 1}, {1, 0},
-        {0, 1}, {1, 7}, {7, 0}, {0, 7}, {7, 10}, {10, 0},
-        {0, 10}, {10, 11}, {11, 0},
-        {1, 5}, {5, 9}, {9, 1},
-        {5, 11}, {11, 4}, {4, 5},
-        {11, 10}, {10, 2}, {2, 11},
-        {10, 7}, {7, 6}, {6, 10},
-        {7, 1}, {1, 8}, {8, 7},
-        {3, 9}, {9, 4}, {4, 3},
-        {3, 4}, {4, 2}, {2, 3},
-        {3, 2}, {2, 6}, {6, 3},
-        {3, 6}, {6, 8}, {8, 3},
-        {3, 8}, {8, 9}, {9, 3}
+int main(int argc, char** argv) {
+    std::cout << "=== 3D Renderer with Object INSIDE Transparent Sphere ===" << std::endl;
+
+    std::vector<ViewConfig> views = {
+        {"front", Vec3f(0, 0, 5), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
+        {"side", Vec3f(5, 0, 0), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
+        {"top", Vec3f(0, 5, 0), Vec3f(0, 0, 0), Vec3f(0, 0, -1), 45.0f},
+        {"three_quarter", Vec3f(3, 2, 4), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 50.0f}
     };
 
-    for (const auto& edge : edges) {
-        Vec3f v1 = sphere_vertices[edge.first];
-        Vec3f v2 = sphere_vertices[edge.second];
-
-        Matrix viewProj = camera.getViewProjectionMatrix();
-        Vec3f p1 = viewProj * v1;
-        Vec3f p2 = viewProj * v2;
-
-        int x1 = (int)((p1.x + 1.0f) * width / 2.0f);
-        int y1 = (int)((p1.y + 1.0f) * height / 2.0f);
-        int x2 = (int)((p2.x + 1.0f) * width / 2.0f);
-        int y2 = (int)((p2.y + 1.0f) * height / 2.0f);
-
-        // Простая линия Брезенхема для контура
-        bool steep = false;
-        if (std::abs(x1 - x2) < std::abs(y1 - y2)) {
-            std::swap(x1, y1);
-            std::swap(x2, y2);
-            steep = true;
+    // Аргументы: [файл модели] [--no-tiles] [--no-hiz] [--deferred] [--threads N] [--jobs N]
+    //            [--raster scanline|edge] [--oit ordered|weighted|abuffer] [--abuffer-mb N] [--msaa 1|4|8]
+    //            [--depth d16|d24|d32f] [--no-depth-compression] [--filter point|bilinear|trilinear]
+    //            [--wrap repeat|clamp] [--texture-layout linear|tiled|morton] [--bench-texture file.tga]
+    //            [--shading flat|gouraud|textured|phong] [--maps prefix] [--shadows] [--shadow-size N]
+    //            [--sphere-subdivisions N] [--outline-depth] [--turntable N]
+    //            [--format tga|ppm|png|pfm] [--save-depth] [--write-queue N]
+    //            [--camera ex,ey,ez[,tx,ty,tz[,fov]]]...
+    const char* model_file = "object.obj";
+    RenderSettings settings = { true, true, false, TRANSPARENCY_ORDERED, 16, 1, DEPTH_D24, true,
+        { FILTER_TRILINEAR, WRAP_CLAMP }, SHADER_TEXTURED, 0, RASTER_SCANLINE, false, 1024, 0, false };
+    // карты нормалей и бликов лежат под исходным именем модели
+    const char* maps_prefix = "african_head";
+    int njobs = 0;
+    int turntable = 0;  // кадров анимации, 0 - неподвижные виды
+    ImageFormat output_format = IMAGE_TGA;
+    bool save_depth = false;  // глубина вида в <имя>_depth.pfm
+    int write_queue = 4;      // кадров в очереди записи
+    TextureLayout texture_layout = TEXTURE_LINEAR;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-tiles") settings.tiled = false;
+        else if (arg == "--no-hiz") settings.hiz = false;
+        else if (arg == "--deferred") settings.deferred = true;
+        else if (arg == "--raster" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "edge") settings.mode = RASTER_EDGE;
+            else if (mode == "scanline") settings.mode = RASTER_SCANLINE;
+            else std::cout << "Unknown raster mode " << mode << ", using scanline" << std::endl;
         }
-        if (x1 > x2) {
-            std::swap(x1, x2);
-            std::swap(y1, y2);
+        else if (arg == "--oit" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "weighted") settings.transparency = TRANSPARENCY_WEIGHTED;
+            else if (mode == "abuffer") settings.transparency = TRANSPARENCY_ABUFFER;
+            else if (mode == "ordered") settings.transparency = TRANSPARENCY_ORDERED;
+            else std::cout << "Unknown transparency mode " << mode << ", using ordered" << std::endl;
         }
-
-        int dx = x2 - x1;
-        int dy = y2 - y1;
-        int derror2 = std::abs(dy) * 2;
-        int error2 = 0;
-        int y = y1;
-
-        for (int x = x1; x <= x2; x++) {
-            if (steep) {
-                if (x >= 0 && x < height && y >= 0 && y < width) {
-                    image.set(y, x, sphere_outline);
-                }
-            }
-            else {
-                if (x >= 0 && x < width && y >= 0 && y < height) {
-                    image.set(x, y, sphere_outline);
-                }
-            }
-            error2 += derror2;
-            if (error2 > dx) {
-                y += (y2 > y1 ? 1 : -1);
-                error2 -= dx * 2;
+        else if (arg == "--msaa" && i + 1 < argc) {
+            int samples = atoi(argv[++i]);
+            if (valid_sample_count(samples)) settings.samples = samples;
+            else std::cout << "Unsupported sample count " << samples << ", MSAA off" << std::endl;
+        }
+        else if (arg == "--depth" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "d16") settings.depth_format = DEPTH_D16;
+            else if (format == "d24") settings.depth_format = DEPTH_D24;
+            else if (format == "d32f") settings.depth_format = DEPTH_D32F;
+            else std::cout << "Unknown depth format " << format << ", using d24" << std::endl;
+        }
+        else if (arg == "--no-depth-compression") settings.depth_compression = false;
+        else if (arg == "--texture-layout" && i + 1 < argc) {
+            std::string layout = argv[++i];
+            if (layout == "linear") texture_layout = TEXTURE_LINEAR;
+            else if (layout == "tiled") texture_layout = TEXTURE_TILED;
+            else if (layout == "morton") texture_layout = TEXTURE_MORTON;
+            else std::cout << "Unknown texture layout " << layout << ", using linear" << std::endl;
+        }
+        else if (arg == "--bench-texture" && i + 1 < argc) {
+            run_texture_benchmark(argv[++i]);
+            return 0;
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            std::string filter = argv[++i];
+            if (filter == "point") settings.sampler.filter = FILTER_POINT;
+            else if (filter == "bilinear") settings.sampler.filter = FILTER_BILINEAR;
+            else if (filter == "trilinear") settings.sampler.filter = FILTER_TRILINEAR;
+            else std::cout << "Unknown texture filter " << filter << ", using trilinear" << std::endl;
+        }
+        else if (arg == "--wrap" && i + 1 < argc) {
+            std::string wrap = argv[++i];
+            if (wrap == "repeat") settings.sampler.wrap = WRAP_REPEAT;
+            else if (wrap == "clamp") settings.sampler.wrap = WRAP_CLAMP;
+            else std::cout << "Unknown texture wrap " << wrap << ", using clamp" << std::endl;
+        }
+        else if (arg == "--shading" && i + 1 < argc) {
+            std::string shading = argv[++i];
+            if (shading == "flat") settings.shading = SHADER_FLAT;
+            else if (shading == "gouraud") settings.shading = SHADER_GOURAUD;
+            else if (shading == "textured") settings.shading = SHADER_TEXTURED;
+            else if (shading == "phong") settings.shading = SHADER_PHONG;
+            else std::cout << "Unknown shading " << shading << ", using textured" << std::endl;
+        }
+        else if (arg == "--maps" && i + 1 < argc) maps_prefix = argv[++i];
+        else if (arg == "--shadows") settings.shadows = true;
+        else if (arg == "--shadow-size" && i + 1 < argc) settings.shadow_size = std::max(16, atoi(argv[++i]));
+        else if (arg == "--sphere-subdivisions" && i + 1 < argc) settings.sphere_subdivisions = atoi(argv[++i]);
+        else if (arg == "--outline-depth") settings.outline_depth = true;
+        else if (arg == "--turntable" && i + 1 < argc) turntable = std::max(0, atoi(argv[++i]));
+        else if (arg == "--format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "tga") output_format = IMAGE_TGA;
+            else if (format == "ppm") output_format = IMAGE_PPM;
+            else if (format == "png") output_format = IMAGE_PNG;
+            else if (format == "pfm") output_format = IMAGE_PFM;
+            else std::cout << "Unknown image format " << format << ", using tga" << std::endl;
+        }
+        else if (arg == "--save-depth") save_depth = true;
+        else if (arg == "--write-queue" && i + 1 < argc) write_queue = std::max(1, atoi(argv[++i]));
+        else if (arg == "--abuffer-mb" && i + 1 < argc) {
+            int mb = atoi(argv[++i]);
+            if (mb >= 0 && mb <= max_abuffer_mb) settings.abuffer_mb = mb;
+            else std::cout << "A-buffer size must be 0.." << max_abuffer_mb << " MB, using " << settings.abuffer_mb << std::endl;
+        }
+        else if (arg == "--threads" && i + 1 < argc) settings.threads = atoi(argv[++i]);
+        else if (arg == "--jobs" && i + 1 < argc) njobs = atoi(argv[++i]);
+        else if (arg == "--camera" && i + 1 < argc) {
+            float p[7] = { 0, 0, 0, 0, 0, 0, 45.0f };
+            int n = sscanf(argv[++i], "%f,%f,%f,%f,%f,%f,%f", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5], &p[6]);
+            if (n < 3) {
+                std::cout << "Bad camera " << argv[i] << ", expected ex,ey,ez[,tx,ty,tz[,fov]]" << std::endl;
+                continue;
             }
+            ViewConfig config = { "camera" + std::to_string(views.size() - 3), Vec3f(p[0], p[1], p[2]),
+                Vec3f(p[3], p[4], p[5]), Vec3f(0, 1, 0), p[6] };
+            // взгляд вдоль оси Y - берём другой up, как у вида сверху
+            Vec3f dir = config.target - config.eye;
+            if (std::abs(dir.y) > 0.99f * dir.norm()) config.up = Vec3f(0, 0, -1);
+            views.push_back(config);
         }
+        else model_file = argv[i];
     }
-}
-
-int main(int argc, char** argv) {
-    std::cout << "=== 3D Renderer with Object INSIDE Transparent Sphere ===" << std::endl;
 
-    if (argc == 2) {
-        model = new Model(argv[1]);
-    }
-    else {
-        model = new Model("object.obj");
+    // Анимация: камера облетает голову по кругу, четыре стандартных вида заменяются кадрами.
+    // Виды из --camera остаются и рендерятся после кадров
+    if (turntable > 0) {
+        std::vector<ViewConfig> cameras(views.begin() + 4, views.end());
+        views.clear();
+        for (int k = 0; k < turntable; k++) {
+            float angle = 2.0f * 3.14159265f * k / turntable;
+            char name[32];
+            snprintf(name, sizeof(name), "turntable_%04d", k);
+            views.push_back({ name, Vec3f(5.0f * std::sin(angle), 1.5f, 5.0f * std::cos(angle)),
+                Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f });
+        }
+        views.insert(views.end(), cameras.begin(), cameras.end());
     }
 
+    model = new Model(model_file, texture_layout, maps_prefix);
+
     if (model->nverts() == 0) {
         std::cout << "ERROR: Failed to load model!" << std::endl;
         return 1;
@@ -372,150 +575,217 @@ int main(int argc, char** argv) {
     std::cout << "Model loaded: " << model->nverts() << " vertices, "
         << model->nfaces() << " faces" << std::endl;
 
-    Vec3f light_dir(0.2f, 0.4f, -1.0f);
-    light_dir.normalize();
-
-    float material_specular = 0.4f;
-    float shininess = 32.0f;
-
-    const char* view_names[] = { "front", "side", "top", "three_quarter" };
-
-    struct ViewConfig {
-        Vec3f eye;
-        Vec3f target;
-        Vec3f up;
-        float fov;
-    };
-
-    ViewConfig view_configs[] = {
-        {Vec3f(0, 0, 5), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
-        {Vec3f(5, 0, 0), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
-        {Vec3f(0, 5, 0), Vec3f(0, 0, 0), Vec3f(0, 0, -1), 45.0f},
-        {Vec3f(3, 2, 4), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 50.0f}
-    };
-
-    for (int view = 0; view < 4; view++) {
-        std::cout << "\n=== Rendering " << view_names[view] << " view... ===" << std::endl;
-
-        ViewConfig config = view_configs[view];
-        Camera camera(config.eye, config.target, config.up,
-            config.fov, (float)width / height, 0.1f, 100.0f);
-
-        TGAImage image(width, height, TGAImage::RGB);
-        float* zbuffer = new float[width * height];
-        for (int i = 0; i < width * height; i++) {
-            zbuffer[i] = -std::numeric_limits<float>::max();
-        }
-
-        std::cout << "1. Rendering back faces of sphere... ";
-        render_sphere_with_layers(camera, image, zbuffer, light_dir);
-        std::cout << "Done" << std::endl;
-
-        std::cout << "2. Rendering object inside sphere... ";
-
-        int rendered_faces = 0;
-        int total_faces = model->nfaces();
-
-        // Рендерим объект (голову)
-        for (int i = 0; i < total_faces; i++) {
-            if (i % (total_faces / 50) == 0) {
-                std::cout << ".";
-                std::cout.flush();
-            }
-
-            std::vector<int> face = model->face(i);
-            if (face.size() < 3) continue;
-
-            Vec3i screen_coords[3];
-            Vec3f world_coords[3];
-            Vec2i uv_coords[3];
-
-            for (int j = 0; j < 3; j++) {
-                int vert_idx = face[j];
-                if (vert_idx < 0 || vert_idx >= model->nverts()) {
-                    screen_coords[j] = Vec3i(0, 0, 0);
-                    continue;
-                }
-
-                Vec3f v = model->vert(vert_idx);
-                world_coords[j] = v;
-
-                Matrix viewProj = camera.getViewProjectionMatrix();
-                Vec3f transformed = viewProj * v;
-
-                screen_coords[j] = Vec3i(
-                    (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                    (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                    (int)(transformed.z * 1000.0f)
-                );
-
-                uv_coords[j] = model->uv(i, j);
+    // Вершины модели и сферы преобразуются один раз на вид
+    std::vector<Vec3f> model_positions(model->nverts());
+    for (int i = 0; i < model->nverts(); i++) {
+        model_positions[i] = model->vert(i);
+    }
+    // Сфера строится один раз и дальше общая для всех видов и проходов
+    const SphereMesh& sphere = icosphere(settings.sphere_subdivisions, 1.4f);
+
+    // Свет неподвижен, поэтому карта теней строится один раз до видов и дальше только читается.
+    // Тень отбрасывает голова: сфера прозрачная
+    std::unique_ptr<ShadowMap> shadow;
+    if (settings.shadows) {
+        auto shadow_start = std::chrono::steady_clock::now();
+        Vec3f lo = model_positions[0], hi = model_positions[0];
+        for (const Vec3f& p : model_positions) {
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], p[k]);
+                hi[k] = std::max(hi[k], p[k]);
             }
-
-            bool outside = true;
+        }
+        Vec3f center = (lo + hi) * 0.5f;
+        float radius = 0.0f;
+        for (const Vec3f& p : model_positions) radius = std::max(radius, (p - center).norm());
+
+        std::vector<int> indices;
+        indices.reserve(model->nfaces() * 3);
+        for (int i = 0; i < model->nfaces(); i++) {
+            if (model->face_size(i) < 3) continue;
+            bool valid = true;
             for (int j = 0; j < 3; j++) {
-                if (screen_coords[j].x >= -100 && screen_coords[j].x < width + 100 &&
-                    screen_coords[j].y >= -100 && screen_coords[j].y < height + 100) {
-                    outside = false;
-                    break;
-                }
-            }
-
-            if (outside) continue;
-
-            Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
-            float norm = n.norm();
-            if (norm > 0) {
-                n.normalize();
-
-                Vec3f view_dir = (camera.getEye() - world_coords[0]);
-                view_dir.normalize();
-
-                Vec3f light_dir_neg = light_dir * (-1.0f);
-                Vec3f reflect_dir = light_dir_neg.reflect(n);
-                reflect_dir.normalize();
-
-                float ambient = 0.25f;
-                float diffuse = std::abs(n * light_dir);
-                float specular = material_specular * std::pow(std::max(0.0f, view_dir * reflect_dir), shininess);
-
-                float intensity = ambient + diffuse + specular;
-                intensity = std::min(1.0f, std::max(0.0f, intensity));
-
-                if (intensity > 0.0f) {
-                    rendered_faces++;
-                    triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                        uv_coords[0], uv_coords[1], uv_coords[2],
-                        image, intensity, zbuffer, false, white, model);
-                }
+                int v = model->vert_index(i, j);
+                valid = valid && v >= 0 && v < model->nverts();
             }
+            if (!valid) continue;
+            for (int j = 0; j < 3; j++) indices.push_back(model->vert_index(i, j));
         }
+        shadow.reset(new ShadowMap(settings.shadow_size));
+        shadow->set_light(light_direction, center, radius);
+        shadow->render(model_positions, indices);
+        double shadow_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shadow_start).count();
+        std::cout << "Shadow map: " << shadow->size() << "x" << shadow->size() << ", PCF "
+            << 2 * ShadowMap::PCF_RADIUS + 1 << "x" << 2 * ShadowMap::PCF_RADIUS + 1 << ", "
+            << shadow_ms << " ms, shared by " << views.size() << " views" << std::endl;
+    }
 
-        std::cout << " Done" << std::endl;
-
-        std::cout << "3. Rendering front (transparent) faces of sphere... ";
-        render_front_sphere_faces(camera, image, zbuffer, light_dir);
-        std::cout << "Done" << std::endl;
-
-        std::cout << "4. Rendering sphere outline... ";
-        render_sphere_outline(camera, image, zbuffer);
-        std::cout << "Done" << std::endl;
+    // Виды независимы: каждый рендерится отдельной задачей, запись файла - ещё одной.
+    // Потоков тайлового рендера на вид столько, чтобы вместе с задачами не превысить число ядер
+    JobSystem jobs(njobs);
+    int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+    if (settings.threads <= 0) {
+        // кадры анимации идут по одному, весь параллелизм уходит в тайлы
+        int concurrent = turntable > 0 ? 1 : std::min(jobs.size(), (int)views.size());
+        settings.threads = std::max(1, hardware / concurrent);
+    }
 
-        std::cout << "Faces rendered: " << rendered_faces << "/" << total_faces << std::endl;
+    std::vector<std::unique_ptr<ViewContext> > contexts;
+    for (int i = 0; i < jobs.size(); i++) {
+        contexts.push_back(std::unique_ptr<ViewContext>(new ViewContext(settings, model_positions, sphere)));
+    }
 
-        std::string filename = std::string("output_") + view_names[view] + "_layered_sphere.tga";
-        if (image.write_tga_file(filename.c_str())) {
+    const Renderer& renderer = contexts[0]->renderer;
+    const char* raster_name = settings.mode == RASTER_EDGE ? "edge-function" : "scanline";
+    if (renderer.tiled()) {
+        std::cout << "Tiled " << raster_name << " renderer: " << Renderer::TILE_SIZE << "x" << Renderer::TILE_SIZE
+            << " tiles, " << renderer.threads() << " threads" << std::endl;
+    }
+    else {
+        std::cout << "Single-threaded " << raster_name << " renderer" << std::endl;
+    }
+    if (settings.samples > 1) {
+        std::cout << settings.samples << "x MSAA";
+        if (settings.deferred || settings.transparency != TRANSPARENCY_ORDERED || settings.hiz) {
+            std::cout << " (forward, ordered transparency, no hi-Z)";
+        }
+        std::cout << std::endl;
+    }
+    const char* depth_names[] = { "D16", "D24", "D32F" };
+    std::cout << "Depth buffer: " << depth_names[settings.depth_format] << ", "
+        << (settings.depth_compression ? "tile compression" : "uncompressed") << std::endl;
+    const char* filter_names[] = { "point", "bilinear", "trilinear" };
+    const char* layout_names[] = { "linear", "tiled 4x4", "Morton" };
+    std::cout << "Texture filter: " << filter_names[settings.sampler.filter]
+        << (settings.sampler.wrap == WRAP_REPEAT ? ", repeat" : ", clamp")
+        << ", " << layout_names[texture_layout] << " layout" << std::endl;
+    if (settings.shading == SHADER_PHONG) {
+        std::cout << "Shading: per-pixel Phong, "
+            << (model->normal_map().empty() ? "vertex normals" : model->tangent_normals() ? "tangent-space normal map" : "object-space normal map")
+            << (model->specular_map().empty() ? "" : ", specular map") << std::endl;
+    }
+    else {
+        const char* shading_names[] = { "flat", "Gouraud", "textured" };
+        std::cout << "Shading: " << shading_names[settings.shading] << std::endl;
+    }
+    std::cout << "Ice sphere: " << sphere.subdivisions << " subdivisions, " << sphere.nfaces() << " faces, "
+        << sphere.vertices.size() << " vertices" << std::endl;
+    std::cout << "Job system: " << jobs.size() << " workers, " << views.size() << " views" << std::endl;
+    if (turntable > 0) {
+        std::cout << "Turntable: " << turntable << " frames, turntable_NNNN" << image_extension(output_format);
+        if (views.size() > (size_t)turntable) std::cout << ", then " << views.size() - turntable << " --camera views";
+        std::cout << std::endl;
+    }
+    const char* format_names[] = { "TGA (RLE)", "PPM", "PNG (stored)", "PFM" };
+    std::cout << "Output: " << format_names[output_format] << (save_depth ? ", depth as PFM" : "")
+        << ", writer thread with " << write_queue << " queued frames" << std::endl;
+
+    std::mutex log_mutex;
+    TargetPool targets;
+    // после targets: разрушается первым и дописывает очередь, пока цели ещё живы
+    ImageWriter writer(write_queue);
+    double total_ms = 0.0;
+    long long last_frame_allocs = 0;  // операций new на всех потоках за последний кадр анимации
+    long long last_frame_bytes = 0;
+    long long allocs_start = heap_allocations();
+    long long bytes_start = heap_bytes();
+    auto batch_start = std::chrono::steady_clock::now();
+
+    // Запись идёт в потоке записи параллельно с рендером следующих видов.
+    // Очередь обслуживается по порядку, поэтому цель освобождает запись цвета, идущая последней
+    auto report = [&log_mutex](const char* filename, bool ok) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (ok) {
             std::cout << "Saved: " << filename << std::endl;
         }
         else {
             std::cout << "ERROR saving: " << filename << std::endl;
         }
+    };
+    std::function<void(RenderTarget*, const char*, bool)> color_written = [&](RenderTarget* target, const char* filename, bool ok) {
+        targets.release(target);
+        report(filename, ok);
+    };
 
-        delete[] zbuffer;
+    // Кадры анимации идут цепочкой: отрендеренный кадр ставит в очередь свою запись и
+    // следующий кадр, так что запись кадра k идёт параллельно с рендером кадра k + 1.
+    // Модель, текстуры, буферы воркеров и цели рендера при этом переиспользуются.
+    // Тело задачи одно на все виды: задача и колбэк записи хранят только указатель и
+    // номер, это помещается в сам std::function, и на кадр не уходит ни одного new
+    std::function<void(size_t)> submit_view;
+    std::function<void(size_t, int)> view_job = [&](size_t view, int worker) {
+        bool frame = view < (size_t)turntable;  // кадр анимации, а не вид из --camera
+        // счётчик всего процесса: запись прошлого кадра в потоке записи тоже попадает сюда
+        long long allocs_before = heap_allocations();
+        long long bytes_before = heap_bytes();
+        RenderTarget* target = targets.acquire();
+        if (save_depth) target->depth.resize(width * height);
+        ViewContext& ctx = *contexts[worker];
+        ctx.log.str("");
+        double view_ms = render_view(views[view], ctx, sphere, shadow.get(), target->color,
+            save_depth ? target->depth.data() : nullptr, ctx.log);
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            total_ms += view_ms;
+            if (!frame) std::cout << ctx.log.rdbuf();
+        }
+
+        const char* pattern = frame ? "%s%s%s" : "output_%s_layered_sphere%s%s";
+        char filename[256];
+        if (save_depth) {
+            ImageView depth = { width, height, 1, nullptr, target->depth.data() };
+            snprintf(filename, sizeof(filename), pattern, views[view].name.c_str(), "_depth", ".pfm");
+            writer.write(filename, IMAGE_PFM, depth, report);
+        }
+        TGAImage& image = target->color.image();
+        ImageView color = { image.get_width(), image.get_height(), image.get_bytespp(), image.buffer(), nullptr };
+        snprintf(filename, sizeof(filename), pattern, views[view].name.c_str(), "", image_extension(output_format));
+        const auto* written = &color_written;
+        writer.write(filename, output_format, color, [written, target](const char* filename, bool ok) {
+            (*written)(target, filename, ok);
+        });
+        if (turntable > 0 && view + 1 < views.size()) submit_view(view + 1);
+
+        if (frame) {
+            long long allocs = heap_allocations() - allocs_before;
+            long long bytes = heap_bytes() - bytes_before;
+            std::lock_guard<std::mutex> lock(log_mutex);
+            last_frame_allocs = allocs;
+            last_frame_bytes = bytes;
+            std::cout << "Frame " << view + 1 << "/" << turntable << ": " << view_ms << " ms, "
+                << allocs << " heap allocations, " << bytes << " bytes" << std::endl;
+        }
+    };
+    submit_view = [&](size_t view) {
+        const auto* job = &view_job;
+        jobs.submit([job, view](int worker) { (*job)(view, worker); });
+    };
+    if (turntable > 0) submit_view(0);
+    else {
+        for (size_t view = 0; view < views.size(); view++) submit_view(view);
     }
+    jobs.wait();
+    writer.wait();
 
+    double batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+    long long batch_allocs = heap_allocations() - allocs_start;
+    long long batch_bytes = heap_bytes() - bytes_start;
+    contexts.clear();
     delete model;
-    std::cout << "\n=== All 4 views rendered with Object INSIDE Layered Sphere! ===" << std::endl;
+    std::cout << "\nTotal raster time (" << raster_name << "): " << total_ms << " ms" << std::endl;
+    std::cout << "Wall time for " << views.size() << " views: " << batch_ms << " ms";
+    if (turntable > 0) std::cout << ", " << views.size() * 1000.0 / batch_ms << " frames/s";
+    std::cout << std::endl;
+    std::cout << "Render targets: " << targets.size() << " for " << views.size() << " views" << std::endl;
+    std::cout << "Image writer: " << writer.written() << " files, " << (writer.bytes() >> 10) << " KB, encoding "
+        << writer.encode_ms() << " ms, disk " << writer.disk_ms() << " ms, queue full " << writer.stalls()
+        << (writer.stalls() == 1 ? " time" : " times") << std::endl;
+    // все потоки; первые кадры заводят буферы, дальше new не должно быть
+    std::cout << "Heap allocations on all threads: " << batch_allocs << " (" << (batch_bytes >> 10)
+        << " KB) during the batch";
+    if (turntable > 0) std::cout << ", " << last_frame_allocs << " (" << last_frame_bytes << " bytes) in the last frame";
+    std::cout << std::endl;
+    std::cout << "\n=== All " << views.size() << " views rendered with Object INSIDE Layered Sphere! ===" << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -3,9 +3,11 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <cmath>
 #include "model.h"
 
-Model::Model(const char* filename) : verts_(), faces_(), norms_(), uv_() {
+Model::Model(const char* filename, TextureLayout layout, const char* maps)
+    : verts_(), faces_(), norms_(), uv_(), tangent_normals_(false) {
     std::ifstream in;
     in.open(filename, std::ifstream::in);
     if (in.fail()) return;
@@ -44,7 +46,70 @@ Model::Model(const char* filename) : verts_(), faces_(), norms_(), uv_() {
         }
     }
     std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
+    std::string basename(filename);
+    size_t dot = basename.find_last_of(".");
+    if (dot != std::string::npos) basename = basename.substr(0, dot);
+    std::string maps_basename = maps ? std::string(maps) : basename;
+
+    TGAImage diffuse;
+    if (load_texture(basename, "_diffuse.tga", diffuse)) diffusemap_.load(diffuse, layout);
+    // a tangent-space map wins over the object-space one
+    TGAImage normals;
+    if (std::ifstream(maps_basename + "_nm_tangent.tga").good() && load_texture(maps_basename, "_nm_tangent.tga", normals)) {
+        tangent_normals_ = true;
+    }
+    else load_texture(maps_basename, "_nm.tga", normals);
+    normalmap_.load(normals, layout);
+    TGAImage specular;
+    if (load_texture(maps_basename, "_spec.tga", specular)) specularmap_.load(specular, layout);
+    compute_tangents();
+}
+
+// Tangent = dP/du of the faces around each texture vertex, so vertices split on uv
+// seams get their own. Gram-Schmidt against the averaged normal, w is the
+// handedness of (T, N x T) against dP/dv, the bitangent is rebuilt from it.
+void Model::compute_tangents() {
+    if (uv_.empty()) return;
+    std::vector<Vec3f> tan(uv_.size()), bitan(uv_.size()), nrm(uv_.size());
+    for (int i = 0; i < nfaces(); i++) {
+        const std::vector<Vec3i>& f = faces_[i];
+        if (f.size() < 3) continue;
+        for (int k = 1; k + 1 < (int)f.size(); k++) {
+            int c[3] = { 0, k, k + 1 };
+            Vec3f e1 = verts_[f[c[1]][0]] - verts_[f[c[0]][0]];
+            Vec3f e2 = verts_[f[c[2]][0]] - verts_[f[c[0]][0]];
+            Vec2f d1 = uv_[f[c[1]][1]] - uv_[f[c[0]][1]];
+            Vec2f d2 = uv_[f[c[2]][1]] - uv_[f[c[0]][1]];
+            float det = d1.x * d2.y - d2.x * d1.y;
+            if (std::abs(det) < 1e-12f) continue;
+            // dP/du and dP/dv times |det|, i.e. weighted by the uv area of the face
+            float sign = det < 0.0f ? -1.0f : 1.0f;
+            Vec3f t = (e1 * d2.y - e2 * d1.y) * sign;
+            Vec3f b = (e2 * d1.x - e1 * d2.x) * sign;
+            for (int j = 0; j < 3; j++) {
+                int vt = f[c[j]][1];
+                tan[vt] = tan[vt] + t;
+                bitan[vt] = bitan[vt] + b;
+            }
+        }
+        for (int j = 0; j < (int)f.size(); j++) nrm[f[j][1]] = nrm[f[j][1]] + normal(i, j);
+    }
+
+    tangents_.resize(uv_.size());
+    for (size_t i = 0; i < uv_.size(); i++) {
+        Vec3f n = nrm[i];
+        if (n.norm() < 1e-12f) n = Vec3f(0, 0, 1);
+        n.normalize();
+        Vec3f t = tan[i] - n * (n * tan[i]);
+        if (t.norm() < 1e-12f) {
+            // no usable uv gradient, any direction orthogonal to n will do
+            t = std::abs(n.x) < 0.9f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+            t = t - n * (n * t);
+        }
+        t.normalize();
+        float w = ((n ^ t) * bitan[i]) < 0.0f ? -1.0f : 1.0f;
+        tangents_[i] = Vec4f(t, w);
+    }
 }
 
 Model::~Model() {
@@ -68,30 +133,32 @@ Vec3f Model::vert(int i) {
     return verts_[i];
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot != std::string::npos) {
-        texfile = texfile.substr(0, dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
-    }
+bool Model::load_texture(std::string basename, const char* suffix, TGAImage& img) {
+    std::string texfile = basename + std::string(suffix);
+    bool ok = img.read_tga_file(texfile.c_str());
+    std::cerr << "texture file " << texfile << " loading " << (ok ? "ok" : "failed") << std::endl;
+    if (ok) img.flip_vertically();
+    return ok;
 }
 
-TGAColor Model::diffuse(Vec2i uv) {
-    int u = std::max(0, std::min(diffusemap_.get_width() - 1, uv.x));
-    int v = std::max(0, std::min(diffusemap_.get_height() - 1, uv.y));
-    return diffusemap_.get(u, v);
+Vec3f Model::normal(int iface, int nvert) {
+    const std::vector<Vec3i>& f = faces_[iface];
+    int idx = f[nvert][2];
+    Vec3f n;
+    if (idx >= 0 && idx < (int)norms_.size()) n = norms_[idx];
+    else n = (verts_[f[1][0]] - verts_[f[0][0]]) ^ (verts_[f[2][0]] - verts_[f[0][0]]);
+    if (n.norm() < 1e-12f) return Vec3f(0, 0, 1);
+    return n.normalize();
 }
 
-Vec2i Model::uv(int iface, int nvert) {
+Vec4f Model::tangent(int iface, int nvert) {
     int idx = faces_[iface][nvert][1];
-    int u = (int)(uv_[idx].x * (float)diffusemap_.get_width());
-    int v = (int)(uv_[idx].y * (float)diffusemap_.get_height());
-
-    u = std::max(0, std::min(diffusemap_.get_width() - 1, u));
-    v = std::max(0, std::min(diffusemap_.get_height() - 1, v));
+    if (idx < 0 || idx >= (int)tangents_.size()) return Vec4f(1, 0, 0, 1);
+    return tangents_[idx];
+}
 
-    return Vec2i(u, v);
+Vec2f Model::uv(int iface, int nvert) {
+    int idx = faces_[iface][nvert][1];
+    return uv_[idx];
 }
 
@@ -4,6 +4,7 @@
 #include <vector>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "texture.h"
 
 class Model {
 private:
@@ -11,17 +12,31 @@ private:
 	std::vector<std::vector<Vec3i> > faces_;   // grani 
 	std::vector<Vec3f> norms_; // normali vershin
 	std::vector<Vec2f> uv_;  // texture coordinats (u, v)
-	TGAImage diffusemap_; // diffusnai texture
-	void load_texture(std::string filename, const char* suffix, TGAImage& img);
+	std::vector<Vec4f> tangents_; // kasatelnye po texture coordinatam: xyz + znak bitangent v w
+	Texture2D diffusemap_; // diffusnai texture, s mip-urovnyami
+	Texture2D normalmap_;  // normali v prostranstve modeli ili v kasatelnom (tangent_normals_)
+	Texture2D specularmap_;
+	bool tangent_normals_;
+	bool load_texture(std::string basename, const char* suffix, TGAImage& img);
+	void compute_tangents();
 public:
-	Model(const char* filename);
+	// layout of the texture maps; maps is the common prefix of the _nm/_spec files,
+	// the model file name without extension by default
+	Model(const char* filename, TextureLayout layout = TEXTURE_LINEAR, const char* maps = NULL);
 	~Model();
 	int nverts();
 	int nfaces();
 	Vec3f vert(int i);
-	Vec2i uv(int iface, int nvert);
-	TGAColor diffuse(Vec2i uv);
+	Vec2f uv(int iface, int nvert);
+	const Texture2D& diffuse_map() const { return diffusemap_; }
+	const Texture2D& normal_map() const { return normalmap_; }
+	const Texture2D& specular_map() const { return specularmap_; }
+	bool tangent_normals() const { return tangent_normals_; } // normal map is in tangent space
+	Vec3f normal(int iface, int nvert); // vertex normal, normalized
+	Vec4f tangent(int iface, int nvert); // tangent orthogonal to the vertex normal, w = +-1
 	std::vector<int> face(int idx);
+	int face_size(int idx) const { return (int)faces_[idx].size(); }
+	int vert_index(int iface, int nvert) const { return faces_[iface][nvert][0]; } // face(iface)[nvert] without the copy
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
@@ -0,0 +1,1066 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include "rasterizer.h"
+#include "shader.h"
+
+TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg) {
+    float alpha = fg.a / 255.0f;
+
+    unsigned char r = static_cast<unsigned char>(bg.r * (1.0f - alpha) + fg.r * alpha);
+    unsigned char g = static_cast<unsigned char>(bg.g * (1.0f - alpha) + fg.g * alpha);
+    unsigned char b = static_cast<unsigned char>(bg.b * (1.0f - alpha) + fg.b * alpha);
+
+    return TGAColor(r, g, b, 255);
+}
+
+bool triangle_bounds(const TriangleCmd& tri, int width, int height,
+    int& xmin, int& ymin, int& xmax, int& ymax) {
+    Vec2i t0(tri.t[0].x, tri.t[0].y);
+    Vec2i t1(tri.t[1].x, tri.t[1].y);
+    Vec2i t2(tri.t[2].x, tri.t[2].y);
+
+    if (t0.y < 0 && t1.y < 0 && t2.y < 0) return false;
+    if (t0.y >= height && t1.y >= height && t2.y >= height) return false;
+    if (t0.x < 0 && t1.x < 0 && t2.x < 0) return false;
+    if (t0.x >= width && t1.x >= width && t2.x >= width) return false;
+
+    if (t0.y == t1.y && t0.y == t2.y) return false;
+
+    xmin = std::max(0, std::min(t0.x, std::min(t1.x, t2.x)));
+    ymin = std::max(0, std::min(t0.y, std::min(t1.y, t2.y)));
+    xmax = std::min(width - 1, std::max(t0.x, std::max(t1.x, t2.x)));
+    ymax = std::min(height - 1, std::max(t0.y, std::max(t1.y, t2.y)));
+    return true;
+}
+
+namespace {
+
+// Upper bound of the interpolated depth over the pixel rectangle [x0, x1] x [y0, y1].
+// Depth is linear in screen space, so the bound sits in one of the corners. It holds
+// for pixels just outside the triangle too, which the scanline spans may touch.
+inline float depth_bound(const TriangleSetup& s, int x0, int y0, int x1, int y1) {
+    float zx = s.l1x * s.dz1 + s.l2x * s.dz2;
+    float zy = s.l1y * s.dz1 + s.l2y * s.dz2;
+    float zc = s.z0 + s.l1c * s.dz1 + s.l2c * s.dz2;
+    float z = zc + zx * (zx > 0 ? x1 : x0) + zy * (zy > 0 ? y1 : y0);
+    // the kernels round differently, keep the test conservative
+    return z + 1e-5f * (1.0f + std::abs(z));
+}
+
+inline TGAColor slice_get(const FrameSlice& slice, int idx) {
+    return TGAColor(slice.color + idx * slice.bytespp, slice.bytespp);
+}
+
+inline void slice_set(FrameSlice& slice, int idx, const TGAColor& c) {
+    memcpy(slice.color + idx * slice.bytespp, c.raw, slice.bytespp);
+}
+
+// Transparent triangles drawn with OIT or into the A-buffer only test depth
+template <class S>
+inline bool writes_depth(const FrameSlice& slice) {
+    return !(S::transparent && (slice.accum || slice.abuffer));
+}
+
+// Weight from McGuire & Bavoil, "Weighted Blended Order-Independent Transparency", eq. 9,
+// with d the window depth: 0 at the near plane and 1 at the far one. Depth here grows
+// towards the camera, so 1 - d is z normalized over the slice's depth interval.
+inline float oit_weight(const FrameSlice& slice, float z, float alpha) {
+    float k = std::min(1.0f, std::max(0.0f, (z - slice.depth_far) * slice.depth_scale));
+    return alpha * std::max(1e-2f, 3e3f * k * k * k);
+}
+
+// Hands a shaded transparent fragment to whatever target the slice has
+inline void transparent_fragment(FrameSlice& slice, int idx, float z, const TGAColor& color) {
+    if (slice.abuffer) {
+        int x = slice.x0 + idx % slice.stride;
+        int y = slice.y0 + idx / slice.stride;
+        slice.abuffer->insert(x, y, z, color);
+    }
+    else if (slice.accum) {
+        float alpha = color.a / 255.0f;
+        float w = oit_weight(slice, z, alpha);
+        float* acc = slice.accum + 4 * idx;
+        acc[0] += color.r * w;
+        acc[1] += color.g * w;
+        acc[2] += color.b * w;
+        acc[3] += w;
+        slice.revealage[idx] *= 1.0f - alpha;
+    }
+    else {
+        slice_set(slice, idx, blend_colors(slice_get(slice, idx), color));
+    }
+}
+
+template <class S>
+inline void shade_pixel(const S& shader, const TriangleCmd& tri, FrameSlice& slice, int idx, float z, float l1, float l2) {
+    if (slice.visibility && !S::transparent) {
+        slice.visibility[idx] = tri.id;
+        slice.barycentrics[2 * idx] = l1;
+        slice.barycentrics[2 * idx + 1] = l2;
+        return;
+    }
+    if (slice.stats) slice.stats->shaded++;
+
+    TGAColor color = shader.fragment(l1, l2, slice.x0 + idx % slice.stride, slice.y0 + idx / slice.stride);
+    if (S::transparent) transparent_fragment(slice, idx, z, color);
+    else slice_set(slice, idx, color);
+}
+
+// Batched shaders get a 2x2 quad at a time, (x, y) even. The kernels collect the
+// pixels that passed the depth test into lanes, l1 and l2 are set for all four
+// lanes since the shader takes its derivatives from them.
+template <class S>
+inline bool batches(const FrameSlice& slice) {
+    return S::batched && !S::transparent && !slice.visibility;
+}
+
+template <class S>
+inline void shade_quad(const S& shader, FrameSlice& slice, int x, int y, int lanes, const float* l1, const float* l2) {
+    TGAColor colors[4];
+    shader.fragment_quad(x, y, lanes, l1, l2, colors);
+    for (int l = 0; l < 4; l++) {
+        if (!(lanes & (1 << l))) continue;
+        slice_set(slice, (y + (l >> 1) - slice.y0) * slice.stride + x + (l & 1) - slice.x0, colors[l]);
+        if (slice.stats) slice.stats->shaded++;
+    }
+}
+
+template <class S>
+void scanline_kernel(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width, height, xmin, ymin, xmax, ymax)) return;
+
+    TriangleSetup s;
+    if (!setup_triangle(tri, s)) return;
+    const S shader(tri, s);
+
+    Vec2i t0(tri.t[0].x, tri.t[0].y);
+    Vec2i t1(tri.t[1].x, tri.t[1].y);
+    Vec2i t2(tri.t[2].x, tri.t[2].y);
+
+    // spans only decide coverage, attributes come from the setup
+    if (t0.y > t1.y) std::swap(t0, t1);
+    if (t0.y > t2.y) std::swap(t0, t2);
+    if (t1.y > t2.y) std::swap(t1, t2);
+
+    int total_height = t2.y - t0.y;
+    const bool write_depth = writes_depth<S>(slice);
+
+    // rows are independent, so clipping to the slice gives the same pixels as a full-frame pass
+    int ybegin = std::max(t0.y, slice.y0);
+    int yend = std::min(t2.y, slice.y1 - 1);
+
+    // columns xbegin..xend of row y are covered, clipped to the slice
+    auto span = [&](int y, int& xbegin, int& xend) {
+        bool second_half = y > t1.y || t1.y == t0.y;
+        int segment_height = second_half ? t2.y - t1.y : t1.y - t0.y;
+        if (segment_height == 0) segment_height = 1;
+
+        float alpha = (float)(y - t0.y) / total_height;
+        float beta = second_half ? (float)(y - t1.y) / segment_height : (float)(y - t0.y) / segment_height;
+
+        int xA = t0.x + (t2.x - t0.x) * alpha;
+        int xB = second_half ? t1.x + (t2.x - t1.x) * beta : t0.x + (t1.x - t0.x) * beta;
+        if (xA > xB) std::swap(xA, xB);
+
+        xbegin = std::max(xA, slice.x0);
+        xend = std::min(xB, slice.x1 - 1);
+    };
+
+    // depth test and write of pixel (x, y) at barycentrics l1, l2
+    auto depth_test = [&](int x, int y, float l1, float l2, float& z) {
+        z = s.z0 + l1 * s.dz1 + l2 * s.dz2;
+        int idx = (y - slice.y0) * slice.stride + x - slice.x0;
+        float old_z = slice.zbuffer[idx];
+        if (!(old_z < z)) return false;
+        if (write_depth) {
+            slice.zbuffer[idx] = z;
+            if (slice.hiz) slice.hiz->on_write(x, y, old_z);
+        }
+        return true;
+    };
+
+    if (batches<S>(slice)) {
+        // two rows at a time, each quad gets the pixels of both spans that pass
+        for (int qy = ybegin & ~1; qy <= yend; qy += 2) {
+            int xbegin[2] = { 0, 0 }, xend[2] = { -1, -1 };
+            int xlo = std::numeric_limits<int>::max(), xhi = -1;
+            for (int r = 0; r < 2; r++) {
+                if (qy + r < ybegin || qy + r > yend) continue;
+                span(qy + r, xbegin[r], xend[r]);
+                if (xbegin[r] > xend[r]) continue;
+                xlo = std::min(xlo, xbegin[r]);
+                xhi = std::max(xhi, xend[r]);
+            }
+            for (int qx = xlo & ~1; qx <= xhi; qx += 2) {
+                float l1[4], l2[4];
+                int lanes = 0;
+                for (int l = 0; l < 4; l++) {
+                    int x = qx + (l & 1), y = qy + (l >> 1);
+                    l1[l] = s.l1y * y + s.l1c + s.l1x * x;
+                    l2[l] = s.l2y * y + s.l2c + s.l2x * x;
+                    float z;
+                    if (x >= xbegin[l >> 1] && x <= xend[l >> 1] && depth_test(x, y, l1[l], l2[l], z)) lanes |= 1 << l;
+                }
+                if (lanes) shade_quad(shader, slice, qx, qy, lanes, l1, l2);
+            }
+        }
+        return;
+    }
+
+    for (int y = ybegin; y <= yend; y++) {
+        int xbegin, xend;
+        span(y, xbegin, xend);
+
+        float l1_row = s.l1y * y + s.l1c;
+        float l2_row = s.l2y * y + s.l2c;
+        int row = (y - slice.y0) * slice.stride - slice.x0;
+
+        for (int x = xbegin; x <= xend; x++) {
+            float l1 = l1_row + s.l1x * x;
+            float l2 = l2_row + s.l2x * x;
+            float z;
+            if (depth_test(x, y, l1, l2, z)) shade_pixel(shader, tri, slice, row + x, z, l1, l2);
+        }
+    }
+}
+
+} // namespace
+
+void rasterize_scanline(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    with_shader(tri.shader, [&](auto tag) {
+        scanline_kernel<typename decltype(tag)::type>(tri, width, height, slice);
+    });
+}
+
+namespace {
+
+const int BLOCK_SIZE = 8;
+static_assert(BLOCK_SIZE == HiZBuffer::BLOCK_SIZE, "edge kernel blocks must match hi-Z blocks");
+// past this the 32-bit edge function products may overflow, such triangles go to the scanline kernel
+const int EDGE_COORD_LIMIT = 16384;
+
+// E(x, y) = a*x + b*y + c, pixel is inside if E >= 0.
+// Top-left rule is folded into c as bias, so shared edges are drawn exactly once.
+struct EdgeFn {
+    int a, b, c;
+    int bias;
+
+    void setup(const Vec2i& v0, const Vec2i& v1) {
+        a = v0.y - v1.y;
+        b = v1.x - v0.x;
+        c = v0.x * v1.y - v0.y * v1.x;
+        bias = (a > 0 || (a == 0 && b < 0)) ? 0 : -1;
+        c += bias;
+    }
+
+    int at(int x, int y) const { return a * x + b * y + c; }
+
+    // value range over a BLOCK_SIZE x BLOCK_SIZE block with corner at (x, y)
+    int block_min(int x, int y) const {
+        return at(x, y) + std::min(0, a * (BLOCK_SIZE - 1)) + std::min(0, b * (BLOCK_SIZE - 1));
+    }
+    int block_max(int x, int y) const {
+        return at(x, y) + std::max(0, a * (BLOCK_SIZE - 1)) + std::max(0, b * (BLOCK_SIZE - 1));
+    }
+};
+
+struct EdgeSetup {
+    EdgeFn e[3];       // e[i] is the unnormalized barycentric of vertex i
+    float inv_area;
+    float z0, dz1, dz2;
+};
+
+// False for a degenerate triangle
+bool setup_edges(const TriangleCmd& tri, EdgeSetup& s) {
+    Vec2i t0(tri.t[0].x, tri.t[0].y);
+    Vec2i t1(tri.t[1].x, tri.t[1].y);
+    Vec2i t2(tri.t[2].x, tri.t[2].y);
+
+    long long area = (long long)(t1.x - t0.x) * (t2.y - t0.y) - (long long)(t1.y - t0.y) * (t2.x - t0.x);
+    if (area == 0) return false;
+
+    // edges are oriented so that the inside is positive for both windings
+    if (area > 0) {
+        s.e[0].setup(t1, t2);
+        s.e[1].setup(t2, t0);
+        s.e[2].setup(t0, t1);
+    }
+    else {
+        s.e[0].setup(t2, t1);
+        s.e[1].setup(t0, t2);
+        s.e[2].setup(t1, t0);
+        area = -area;
+    }
+
+    s.inv_area = 1.0f / (float)area;
+    s.z0 = tri.t[0].z;
+    s.dz1 = tri.t[1].z - tri.t[0].z;
+    s.dz2 = tri.t[2].z - tri.t[0].z;
+    return true;
+}
+
+// Shades the covered lanes of a 4-pixel row chunk starting at (x, y).
+// l1, l2 are barycentrics of vertices 1 and 2, z already interpolated.
+template <class S>
+inline void shade_lanes(const S& shader, const TriangleCmd& tri, FrameSlice& slice, int x, int y,
+    int mask, const float* z, const float* l1, const float* l2) {
+    int row = (y - slice.y0) * slice.stride - slice.x0;
+    bool write_depth = writes_depth<S>(slice);
+    for (int l = 0; l < 4; l++) {
+        if (!(mask & (1 << l))) continue;
+        int idx = row + x + l;
+        if (write_depth) {
+            if (slice.hiz) slice.hiz->on_write(x + l, y, slice.zbuffer[idx]);
+            slice.zbuffer[idx] = z[l];
+        }
+        shade_pixel(shader, tri, slice, idx, z[l], l1[l], l2[l]);
+    }
+}
+
+template <class S>
+inline void raster_chunk(const S& shader, const TriangleCmd& tri, const EdgeSetup& s, FrameSlice& slice,
+    int x, int y, int lanes, bool full) {
+    int zrow = (y - slice.y0) * slice.stride - slice.x0;
+#ifdef RASTER_SSE2
+    __m128i w[3];
+    for (int i = 0; i < 3; i++) {
+        int a = s.e[i].a;
+        w[i] = _mm_add_epi32(_mm_set1_epi32(s.e[i].at(x, y)), _mm_setr_epi32(0, a, 2 * a, 3 * a));
+    }
+    if (!full) {
+        int outside = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2])));
+        lanes &= ~outside;
+        if (!lanes) return;
+    }
+    __m128 inv_area = _mm_set1_ps(s.inv_area);
+    __m128 l1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[1], _mm_set1_epi32(s.e[1].bias))), inv_area);
+    __m128 l2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[2], _mm_set1_epi32(s.e[2].bias))), inv_area);
+    __m128 z = _mm_add_ps(_mm_set1_ps(s.z0),
+        _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(s.dz1)), _mm_mul_ps(l2, _mm_set1_ps(s.dz2))));
+
+    __m128 zb;
+    if (x >= slice.x0 && x + 3 < slice.x1) {
+        zb = _mm_loadu_ps(slice.zbuffer + zrow + x);
+    }
+    else {
+        float tmp[4];
+        for (int l = 0; l < 4; l++) {
+            tmp[l] = (lanes & (1 << l)) ? slice.zbuffer[zrow + x + l] : std::numeric_limits<float>::max();
+        }
+        zb = _mm_loadu_ps(tmp);
+    }
+    lanes &= _mm_movemask_ps(_mm_cmplt_ps(zb, z));
+    if (!lanes) return;
+
+    float zs[4], l1s[4], l2s[4];
+    _mm_storeu_ps(zs, z);
+    _mm_storeu_ps(l1s, l1);
+    _mm_storeu_ps(l2s, l2);
+    shade_lanes(shader, tri, slice, x, y, lanes, zs, l1s, l2s);
+#else
+    float zs[4], l1s[4], l2s[4];
+    for (int l = 0; l < 4; l++) {
+        if (!(lanes & (1 << l))) continue;
+        int e0 = s.e[0].at(x + l, y), e1 = s.e[1].at(x + l, y), e2 = s.e[2].at(x + l, y);
+        if (!full && (e0 | e1 | e2) < 0) { lanes &= ~(1 << l); continue; }
+        l1s[l] = (float)(e1 - s.e[1].bias) * s.inv_area;
+        l2s[l] = (float)(e2 - s.e[2].bias) * s.inv_area;
+        zs[l] = s.z0 + l1s[l] * s.dz1 + l2s[l] * s.dz2;
+        if (!(slice.zbuffer[zrow + x + l] < zs[l])) lanes &= ~(1 << l);
+    }
+    if (!lanes) return;
+    shade_lanes(shader, tri, slice, x, y, lanes, zs, l1s, l2s);
+#endif
+}
+
+// raster_chunk() for the 2x2 quad with its top-left pixel at (x, y), lanes as
+// in fragment_quad(). Only batched shaders come here.
+template <class S>
+inline void raster_quad(const S& shader, const EdgeSetup& s, FrameSlice& slice, int x, int y, int lanes, bool full) {
+    float* zb = slice.zbuffer + (y - slice.y0) * slice.stride + x - slice.x0;
+    const int offset[4] = { 0, 1, slice.stride, slice.stride + 1 };
+    float zs[4], l1s[4], l2s[4];
+#ifdef RASTER_SSE2
+    __m128i w[3];
+    for (int i = 0; i < 3; i++) {
+        int a = s.e[i].a, b = s.e[i].b;
+        w[i] = _mm_add_epi32(_mm_set1_epi32(s.e[i].at(x, y)), _mm_setr_epi32(0, a, b, a + b));
+    }
+    if (!full) {
+        int outside = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2])));
+        lanes &= ~outside;
+        if (!lanes) return;
+    }
+    __m128 inv_area = _mm_set1_ps(s.inv_area);
+    __m128 l1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[1], _mm_set1_epi32(s.e[1].bias))), inv_area);
+    __m128 l2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[2], _mm_set1_epi32(s.e[2].bias))), inv_area);
+    __m128 z = _mm_add_ps(_mm_set1_ps(s.z0),
+        _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(s.dz1)), _mm_mul_ps(l2, _mm_set1_ps(s.dz2))));
+    _mm_storeu_ps(zs, z);
+    _mm_storeu_ps(l1s, l1);
+    _mm_storeu_ps(l2s, l2);
+#else
+    for (int l = 0; l < 4; l++) {
+        int e0 = s.e[0].at(x + (l & 1), y + (l >> 1)), e1 = s.e[1].at(x + (l & 1), y + (l >> 1)), e2 = s.e[2].at(x + (l & 1), y + (l >> 1));
+        if (!full && (e0 | e1 | e2) < 0) lanes &= ~(1 << l);
+        l1s[l] = (float)(e1 - s.e[1].bias) * s.inv_area;
+        l2s[l] = (float)(e2 - s.e[2].bias) * s.inv_area;
+        zs[l] = s.z0 + l1s[l] * s.dz1 + l2s[l] * s.dz2;
+    }
+    if (!lanes) return;
+#endif
+    bool write_depth = writes_depth<S>(slice);
+    for (int l = 0; l < 4; l++) {
+        if (!(lanes & (1 << l))) continue;
+        float old_z = zb[offset[l]];
+        if (!(old_z < zs[l])) {
+            lanes &= ~(1 << l);
+            continue;
+        }
+        if (write_depth) {
+            if (slice.hiz) slice.hiz->on_write(x + (l & 1), y + (l >> 1), old_z);
+            zb[offset[l]] = zs[l];
+        }
+    }
+    if (lanes) shade_quad(shader, slice, x, y, lanes, l1s, l2s);
+}
+
+template <class S>
+void edge_kernel(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width, height, xmin, ymin, xmax, ymax)) return;
+
+    for (int i = 0; i < 3; i++) {
+        if (std::abs(tri.t[i].x) > EDGE_COORD_LIMIT || std::abs(tri.t[i].y) > EDGE_COORD_LIMIT) {
+            rasterize_scanline(tri, width, height, slice);
+            return;
+        }
+    }
+
+    xmin = std::max(xmin, slice.x0);
+    ymin = std::max(ymin, slice.y0);
+    xmax = std::min(xmax, slice.x1 - 1);
+    ymax = std::min(ymax, slice.y1 - 1);
+    if (xmin > xmax || ymin > ymax) return;
+
+    EdgeSetup s;
+    if (!setup_edges(tri, s)) return;
+    TriangleSetup zs;
+    if (!setup_triangle(tri, zs)) return;
+    bool hiz = slice.hiz != nullptr;
+    const bool batched = batches<S>(slice);
+    const S shader(tri, zs);
+
+    for (int by = ymin - ymin % BLOCK_SIZE; by <= ymax; by += BLOCK_SIZE) {
+        for (int bx = xmin - xmin % BLOCK_SIZE; bx <= xmax; bx += BLOCK_SIZE) {
+            // early-out: block fully outside one edge / fully inside all edges
+            bool full = true;
+            bool rejected = false;
+            for (int i = 0; i < 3 && !rejected; i++) {
+                if (s.e[i].block_max(bx, by) < 0) rejected = true;
+                else if (s.e[i].block_min(bx, by) < 0) full = false;
+            }
+            if (rejected) continue;
+
+            int ylo = std::max(by, ymin), yhi = std::min(by + BLOCK_SIZE - 1, ymax);
+            int xlo = std::max(bx, xmin), xhi = std::min(bx + BLOCK_SIZE - 1, xmax);
+
+            if (hiz && slice.hiz->farthest(slice.hiz->block(bx, by), slice.zbuffer, slice.stride, slice.x0, slice.y0)
+                >= depth_bound(zs, xlo, ylo, xhi, yhi)) {
+                if (slice.stats) slice.stats->hiz_blocks++;
+                continue;
+            }
+
+            if (batched) {
+                // blocks start at even pixels, so their quads are the frame's quads
+                for (int y = ylo & ~1; y <= yhi; y += 2) {
+                    for (int x = xlo & ~1; x <= xhi; x += 2) {
+                        int lanes = 0;
+                        for (int l = 0; l < 4; l++) {
+                            int px = x + (l & 1), py = y + (l >> 1);
+                            if (px >= xlo && px <= xhi && py >= ylo && py <= yhi) lanes |= 1 << l;
+                        }
+                        raster_quad(shader, s, slice, x, y, lanes, full);
+                    }
+                }
+                continue;
+            }
+            for (int y = ylo; y <= yhi; y++) {
+                for (int x = bx; x <= xhi; x += 4) {
+                    int lanes = 0;
+                    for (int l = 0; l < 4; l++) {
+                        if (x + l >= xlo && x + l <= xhi) lanes |= 1 << l;
+                    }
+                    if (lanes) raster_chunk(shader, tri, s, slice, x, y, lanes, full);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+void rasterize_edge(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    with_shader(tri.shader, [&](auto tag) {
+        edge_kernel<typename decltype(tag)::type>(tri, width, height, slice);
+    });
+}
+
+namespace {
+
+// Depth test and write of a 4-pixel row chunk starting at (x, y), nothing else
+inline void depth_chunk(const EdgeSetup& s, FrameSlice& slice, int x, int y, int lanes, bool full) {
+    float* zb = slice.zbuffer + (y - slice.y0) * slice.stride + x - slice.x0;
+#ifdef RASTER_SSE2
+    __m128i w[3];
+    for (int i = 0; i < 3; i++) {
+        int a = s.e[i].a;
+        w[i] = _mm_add_epi32(_mm_set1_epi32(s.e[i].at(x, y)), _mm_setr_epi32(0, a, 2 * a, 3 * a));
+    }
+    if (!full) {
+        int outside = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2])));
+        lanes &= ~outside;
+        if (!lanes) return;
+    }
+    __m128 inv_area = _mm_set1_ps(s.inv_area);
+    __m128 l1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[1], _mm_set1_epi32(s.e[1].bias))), inv_area);
+    __m128 l2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[2], _mm_set1_epi32(s.e[2].bias))), inv_area);
+    __m128 z = _mm_add_ps(_mm_set1_ps(s.z0),
+        _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(s.dz1)), _mm_mul_ps(l2, _mm_set1_ps(s.dz2))));
+    if (lanes == 0xF) {
+        // the whole chunk is inside the slice, test and write without branches
+        __m128 old_z = _mm_loadu_ps(zb);
+        __m128 nearer = _mm_cmplt_ps(old_z, z);
+        _mm_storeu_ps(zb, _mm_or_ps(_mm_and_ps(nearer, z), _mm_andnot_ps(nearer, old_z)));
+        return;
+    }
+    float zs[4];
+    _mm_storeu_ps(zs, z);
+    for (int l = 0; l < 4; l++) {
+        if ((lanes & (1 << l)) && zb[l] < zs[l]) zb[l] = zs[l];
+    }
+#else
+    for (int l = 0; l < 4; l++) {
+        if (!(lanes & (1 << l))) continue;
+        int e0 = s.e[0].at(x + l, y), e1 = s.e[1].at(x + l, y), e2 = s.e[2].at(x + l, y);
+        if (!full && (e0 | e1 | e2) < 0) continue;
+        float z = s.z0 + (float)(e1 - s.e[1].bias) * s.inv_area * s.dz1 + (float)(e2 - s.e[2].bias) * s.inv_area * s.dz2;
+        if (zb[l] < z) zb[l] = z;
+    }
+#endif
+}
+
+} // namespace
+
+void rasterize_depth(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width, height, xmin, ymin, xmax, ymax)) return;
+    for (int i = 0; i < 3; i++) {
+        if (std::abs(tri.t[i].x) > EDGE_COORD_LIMIT || std::abs(tri.t[i].y) > EDGE_COORD_LIMIT) return;
+    }
+
+    xmin = std::max(xmin, slice.x0);
+    ymin = std::max(ymin, slice.y0);
+    xmax = std::min(xmax, slice.x1 - 1);
+    ymax = std::min(ymax, slice.y1 - 1);
+    if (xmin > xmax || ymin > ymax) return;
+
+    EdgeSetup s;
+    if (!setup_edges(tri, s)) return;
+
+    for (int by = ymin - ymin % BLOCK_SIZE; by <= ymax; by += BLOCK_SIZE) {
+        for (int bx = xmin - xmin % BLOCK_SIZE; bx <= xmax; bx += BLOCK_SIZE) {
+            bool full = true;
+            bool rejected = false;
+            for (int i = 0; i < 3 && !rejected; i++) {
+                if (s.e[i].block_max(bx, by) < 0) rejected = true;
+                else if (s.e[i].block_min(bx, by) < 0) full = false;
+            }
+            if (rejected) continue;
+
+            int ylo = std::max(by, ymin), yhi = std::min(by + BLOCK_SIZE - 1, ymax);
+            int xlo = std::max(bx, xmin), xhi = std::min(bx + BLOCK_SIZE - 1, xmax);
+            for (int y = ylo; y <= yhi; y++) {
+                for (int x = bx; x <= xhi; x += 4) {
+                    int lanes = 0;
+                    for (int l = 0; l < 4; l++) {
+                        if (x + l >= xlo && x + l <= xhi) lanes |= 1 << l;
+                    }
+                    if (lanes) depth_chunk(s, slice, x, y, lanes, full);
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+// Pixels of the 2x2 quad at (x, y) that triangle id is visible in, lanes as in fragment_quad()
+int visible_lanes(const int* vis, const FrameSlice& slice, int x, int y, int id) {
+    int lanes = 0;
+    for (int l = 0; l < 4; l++) {
+        int px = x + (l & 1), py = y + (l >> 1);
+        if (px < slice.x0 || px >= slice.x1 || py < slice.y0 || py >= slice.y1) continue;
+        if (vis[(py - slice.y0) * slice.stride + px - slice.x0] == id) lanes |= 1 << l;
+    }
+    return lanes;
+}
+
+// Shades the pixels of triangle id in the quads x0..x1-1 of the quad row at y
+// and takes them out of vis
+template <class S>
+void shade_visible_quads(const TriangleCmd& tri, int* vis, FrameSlice& slice, int id, int y, int x0, int x1) {
+    TriangleSetup s = {};
+    setup_triangle(tri, s);
+    const S shader(tri, s);
+    for (int x = x0; x < x1; x += 2) {
+        int lanes = visible_lanes(vis, slice, x, y, id);
+        float l1[4], l2[4];
+        for (int l = 0; l < 4; l++) {
+            int px = x + (l & 1), py = y + (l >> 1);
+            int idx = (py - slice.y0) * slice.stride + px - slice.x0;
+            if (lanes & (1 << l)) {
+                vis[idx] = -1;
+                l1[l] = slice.barycentrics[2 * idx];
+                l2[l] = slice.barycentrics[2 * idx + 1];
+                if (!batches<S>(slice)) shade_pixel(shader, tri, slice, idx, slice.zbuffer[idx], l1[l], l2[l]);
+            }
+            else {
+                // not this triangle's pixel, extrapolated for the derivatives
+                l1[l] = s.l1y * py + s.l1c + s.l1x * px;
+                l2[l] = s.l2y * py + s.l2c + s.l2x * px;
+            }
+        }
+        if (lanes && batches<S>(slice)) shade_quad(shader, slice, x, y, lanes, l1, l2);
+    }
+}
+
+} // namespace
+
+void shade_visibility(const TriangleCmd* tris, FrameSlice& slice) {
+    // the shaders must not see a visibility buffer, or they would write it again
+    int* vis = slice.visibility;
+    slice.visibility = nullptr;
+    for (int y = slice.y0 & ~1; y < slice.y1; y += 2) {
+        for (int x = slice.x0 & ~1; x < slice.x1; x += 2) {
+            // a quad may hold pixels of up to four triangles, each gets its own pass
+            for (;;) {
+                int id = -1;
+                for (int l = 0; l < 4 && id < 0; l++) {
+                    int px = x + (l & 1), py = y + (l >> 1);
+                    if (px >= slice.x0 && px < slice.x1 && py >= slice.y0 && py < slice.y1) {
+                        id = vis[(py - slice.y0) * slice.stride + px - slice.x0];
+                    }
+                }
+                if (id < 0) break;
+                // one shader setup per run of quads the triangle shows in
+                int end = x + 2;
+                while (end < slice.x1 && visible_lanes(vis, slice, end, y, id)) end += 2;
+                with_shader(tris[id].shader, [&](auto tag) {
+                    shade_visible_quads<typename decltype(tag)::type>(tris[id], vis, slice, id, y, x, end);
+                });
+            }
+        }
+    }
+    slice.visibility = vis;
+}
+
+namespace {
+
+void resolve_abuffer(FrameSlice& slice) {
+    ABuffer& ab = *slice.abuffer;
+    int order[ABuffer::MAX_PIXEL_FRAGMENTS];
+    long long dropped = 0;
+    for (int y = slice.y0; y < slice.y1; y++) {
+        int row = (y - slice.y0) * slice.stride - slice.x0;
+        for (int x = slice.x0; x < slice.x1; x++) {
+            int head = ab.head(x, y);
+            if (head < 0) continue;
+
+            // the list is newest first; insertion sort farthest first (smallest z),
+            // equal depths keep submission order (pool index grows within a slice)
+            int n = 0;
+            for (int i = head; i >= 0; i = ab.fragment(i).next) {
+                if (n == ABuffer::MAX_PIXEL_FRAGMENTS) {
+                    dropped++;
+                    continue;
+                }
+                const ABuffer::Fragment& f = ab.fragment(i);
+                int j = n++;
+                while (j > 0) {
+                    const ABuffer::Fragment& g = ab.fragment(order[j - 1]);
+                    if (g.z < f.z || (g.z == f.z && order[j - 1] < i)) break;
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+
+            int idx = row + x;
+            TGAColor color = slice_get(slice, idx);
+            for (int k = 0; k < n; k++) {
+                const unsigned char* c = ab.fragment(order[k]).rgba;
+                color = blend_colors(color, TGAColor(c[0], c[1], c[2], c[3]));
+            }
+            slice_set(slice, idx, color);
+            ab.reset_head(x, y);
+        }
+    }
+    if (dropped) ab.count_overflow(dropped);
+}
+
+} // namespace
+
+void resolve_transparency(FrameSlice& slice) {
+    if (slice.abuffer) {
+        resolve_abuffer(slice);
+        return;
+    }
+    if (!slice.accum) return;
+    for (int y = slice.y0; y < slice.y1; y++) {
+        int row = (y - slice.y0) * slice.stride - slice.x0;
+        for (int x = slice.x0; x < slice.x1; x++) {
+            int idx = row + x;
+            float reveal = slice.revealage[idx];
+            if (reveal >= 1.0f) continue;
+
+            float* acc = slice.accum + 4 * idx;
+            float inv_weight = 1.0f / std::max(acc[3], 1e-5f);
+            float cover = 1.0f - reveal;
+            TGAColor bg = slice_get(slice, idx);
+            TGAColor out(
+                (unsigned char)std::min(255.0f, acc[0] * inv_weight * cover + bg.r * reveal),
+                (unsigned char)std::min(255.0f, acc[1] * inv_weight * cover + bg.g * reveal),
+                (unsigned char)std::min(255.0f, acc[2] * inv_weight * cover + bg.b * reveal),
+                255);
+            slice_set(slice, idx, out);
+
+            acc[0] = acc[1] = acc[2] = acc[3] = 0.0f;
+            slice.revealage[idx] = 1.0f;
+        }
+    }
+}
+
+bool hiz_occluded(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width, height, xmin, ymin, xmax, ymax)) return false;
+    xmin = std::max(xmin, slice.x0);
+    ymin = std::max(ymin, slice.y0);
+    xmax = std::min(xmax, slice.x1 - 1);
+    ymax = std::min(ymax, slice.y1 - 1);
+    if (xmin > xmax || ymin > ymax) return false;
+
+    TriangleSetup s;
+    if (!setup_triangle(tri, s)) return false;
+
+    // a pixel passes only if its depth is larger than the stored one
+    const int bs = HiZBuffer::BLOCK_SIZE;
+    for (int by = ymin - ymin % bs; by <= ymax; by += bs) {
+        for (int bx = xmin - xmin % bs; bx <= xmax; bx += bs) {
+            float zmax = depth_bound(s, std::max(bx, xmin), std::max(by, ymin),
+                std::min(bx + bs - 1, xmax), std::min(by + bs - 1, ymax));
+            int b = slice.hiz->block(bx, by);
+            if (slice.hiz->farthest(b, slice.zbuffer, slice.stride, slice.x0, slice.y0) < zmax) return false;
+        }
+    }
+    return true;
+}
+
+bool valid_sample_count(int samples) {
+    return samples == 1 || samples == 4 || samples == 8;
+}
+
+namespace {
+
+// Sample offsets from the pixel center in 1/16 pixel. 4x is the rotated grid,
+// 8x the usual D3D pattern; no two samples share a row or a column.
+const int SAMPLE_OFFSETS_4[4][2] = { {-2, -6}, {6, -2}, {2, 6}, {-6, 2} };
+const int SAMPLE_OFFSETS_8[8][2] = { {1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7} };
+
+template <class S>
+void msaa_kernel(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width, height, xmin, ymin, xmax, ymax)) return;
+
+    xmin = std::max(xmin, slice.x0);
+    ymin = std::max(ymin, slice.y0);
+    xmax = std::min(xmax, slice.x1 - 1);
+    ymax = std::min(ymax, slice.y1 - 1);
+    if (xmin > xmax || ymin > ymax) return;
+
+    TriangleSetup s;
+    if (!setup_triangle(tri, s)) return;
+    const S shader(tri, s);
+
+    Vec2i t0(tri.t[0].x, tri.t[0].y);
+    Vec2i t1(tri.t[1].x, tri.t[1].y);
+    Vec2i t2(tri.t[2].x, tri.t[2].y);
+    long long area = (long long)(t1.x - t0.x) * (t2.y - t0.y) - (long long)(t1.y - t0.y) * (t2.x - t0.x);
+    if (area == 0) return;
+
+    EdgeFn e[3];
+    if (area > 0) {
+        e[0].setup(t1, t2);
+        e[1].setup(t2, t0);
+        e[2].setup(t0, t1);
+    }
+    else {
+        e[0].setup(t2, t1);
+        e[1].setup(t0, t2);
+        e[2].setup(t1, t0);
+    }
+
+    const int ns = slice.samples;
+    const int (*offsets)[2] = ns == 8 ? SAMPLE_OFFSETS_8 : SAMPLE_OFFSETS_4;
+    const int all_samples = (1 << ns) - 1;
+    const float zx = s.l1x * s.dz1 + s.l2x * s.dz2;
+    const float zy = s.l1y * s.dz1 + s.l2y * s.dz2;
+    const bool write_depth = writes_depth<S>(slice);
+
+    // Edge functions in 1/16 pixel: E16 = 16 * (E - bias) + bias at the pixel
+    // plus a constant per sample. 64-bit since both factors grow by 16. The
+    // top-left bias keeps shared edges from covering a sample twice.
+    long long sample_offset[3][MAX_SAMPLES];
+    long long offset_min[3], offset_max[3];
+    for (int i = 0; i < 3; i++) {
+        offset_min[i] = offset_max[i] = (long long)e[i].a * offsets[0][0] + (long long)e[i].b * offsets[0][1];
+        for (int k = 0; k < ns; k++) {
+            sample_offset[i][k] = (long long)e[i].a * offsets[k][0] + (long long)e[i].b * offsets[k][1];
+            offset_min[i] = std::min(offset_min[i], sample_offset[i][k]);
+            offset_max[i] = std::max(offset_max[i], sample_offset[i][k]);
+        }
+    }
+    // Per pixel E16 >= 0 solved for the integer E: sample k is inside edge i when
+    // E >= threshold[i][k], a 32-bit compare of E against four samples at once.
+    // Sample depths are the pixel depth plus a constant, also four at a time.
+    alignas(16) int threshold[3][MAX_SAMPLES];
+    alignas(16) float zoffset[MAX_SAMPLES];
+    for (int k = 0; k < ns; k++) {
+        for (int i = 0; i < 3; i++) threshold[i][k] = e[i].bias - (int)((e[i].bias + sample_offset[i][k]) >> 4);
+        zoffset[k] = (zx * offsets[k][0] + zy * offsets[k][1]) * (1.0f / 16.0f);
+    }
+#ifdef RASTER_SSE2
+    const int groups = ns / 4;
+#endif
+
+    for (int by = ymin - ymin % BLOCK_SIZE; by <= ymax; by += BLOCK_SIZE) {
+        for (int bx = xmin - xmin % BLOCK_SIZE; bx <= xmax; bx += BLOCK_SIZE) {
+            // early-out: every sample of the block outside one edge / inside all edges
+            bool full = true;
+            bool rejected = false;
+            for (int i = 0; i < 3 && !rejected; i++) {
+                long long lo = 16LL * (e[i].block_min(bx, by) - e[i].bias) + e[i].bias + offset_min[i];
+                long long hi = 16LL * (e[i].block_max(bx, by) - e[i].bias) + e[i].bias + offset_max[i];
+                if (hi < 0) rejected = true;
+                else if (lo < 0) full = false;
+            }
+            if (rejected) continue;
+
+            int ylo = std::max(by, ymin), yhi = std::min(by + BLOCK_SIZE - 1, ymax);
+            int xlo = std::max(bx, xmin), xhi = std::min(bx + BLOCK_SIZE - 1, xmax);
+
+            for (int y = ylo; y <= yhi; y++) {
+                int row = (y - slice.y0) * slice.stride - slice.x0;
+                for (int x = xlo; x <= xhi; x++) {
+                    int covered = all_samples;
+                    if (!full) {
+                        covered = 0;
+#ifdef RASTER_SSE2
+                        __m128i w0 = _mm_set1_epi32(e[0].at(x, y));
+                        __m128i w1 = _mm_set1_epi32(e[1].at(x, y));
+                        __m128i w2 = _mm_set1_epi32(e[2].at(x, y));
+                        for (int g = 0; g < groups; g++) {
+                            __m128i outside = _mm_or_si128(
+                                _mm_or_si128(_mm_cmplt_epi32(w0, _mm_load_si128((const __m128i*)(threshold[0] + 4 * g))),
+                                    _mm_cmplt_epi32(w1, _mm_load_si128((const __m128i*)(threshold[1] + 4 * g)))),
+                                _mm_cmplt_epi32(w2, _mm_load_si128((const __m128i*)(threshold[2] + 4 * g))));
+                            covered |= (~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 15) << (4 * g);
+                        }
+#else
+                        int w0 = e[0].at(x, y), w1 = e[1].at(x, y), w2 = e[2].at(x, y);
+                        for (int k = 0; k < ns; k++) {
+                            if (w0 >= threshold[0][k] && w1 >= threshold[1][k] && w2 >= threshold[2][k]) covered |= 1 << k;
+                        }
+#endif
+                        if (!covered) continue;
+                    }
+
+                    float z0 = s.z0 + (s.l1y * y + s.l1c + s.l1x * x) * s.dz1 + (s.l2y * y + s.l2c + s.l2x * x) * s.dz2;
+                    int idx = row + x;
+                    float* depth = slice.zbuffer + idx * ns;
+                    alignas(16) float zs[MAX_SAMPLES];
+                    int passed = 0;
+#ifdef RASTER_SSE2
+                    for (int g = 0; g < groups; g++) {
+                        __m128 z = _mm_add_ps(_mm_set1_ps(z0), _mm_load_ps(zoffset + 4 * g));
+                        _mm_store_ps(zs + 4 * g, z);
+                        passed |= (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(depth + 4 * g), z)) & (covered >> (4 * g)) & 15) << (4 * g);
+                    }
+#else
+                    for (int k = 0; k < ns; k++) {
+                        zs[k] = z0 + zoffset[k];
+                        if ((covered & (1 << k)) && depth[k] < zs[k]) passed |= 1 << k;
+                    }
+#endif
+                    if (!passed) continue;
+                    int first = 0;
+                    while (!(passed & (1 << first))) first++;
+
+                    // shade at the pixel center if the triangle covers it, else at a covered sample
+                    float px = (float)x, py = (float)y;
+                    if (!full && (e[0].at(x, y) < 0 || e[1].at(x, y) < 0 || e[2].at(x, y) < 0)) {
+                        px += offsets[first][0] / 16.0f;
+                        py += offsets[first][1] / 16.0f;
+                    }
+                    float l1 = s.l1x * px + s.l1y * py + s.l1c;
+                    float l2 = s.l2x * px + s.l2y * py + s.l2c;
+                    TGAColor color = shader.fragment(l1, l2, x, y);
+                    if (slice.stats) slice.stats->shaded++;
+
+                    if (passed == all_samples && write_depth) {
+                        memcpy(depth, zs, ns * sizeof(float));
+                    }
+                    else if (write_depth) {
+                        for (int k = 0; k < ns; k++) {
+                            if (passed & (1 << k)) depth[k] = zs[k];
+                        }
+                    }
+                    // samples of a pixel mostly hold the same color, blend each distinct one once
+                    TGAColor bg, blended;
+                    for (int k = 0; k < ns; k++) {
+                        if (!(passed & (1 << k))) continue;
+                        int sample = idx * ns + k;
+                        if (!S::transparent) {
+                            slice_set(slice, sample, color);
+                            continue;
+                        }
+                        TGAColor c = slice_get(slice, sample);
+                        if (k == first || c.val != bg.val) {
+                            bg = c;
+                            blended = blend_colors(c, color);
+                        }
+                        slice_set(slice, sample, blended);
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+void rasterize_msaa(const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    with_shader(tri.shader, [&](auto tag) {
+        msaa_kernel<typename decltype(tag)::type>(tri, width, height, slice);
+    });
+}
+
+namespace {
+
+// Sample count and bytes per pixel as constants, so the per-sample loops unroll
+template <int NS, int BPP>
+void broadcast_kernel(FrameSlice& slice, const unsigned char* color, int color_stride,
+    const float* zbuffer, int zbuffer_stride) {
+    for (int y = 0; y < slice.y1 - slice.y0; y++) {
+        int row = y * slice.stride;
+        for (int x = 0; x < slice.x1 - slice.x0; x++) {
+            int idx = row + x;
+            float* depth = slice.zbuffer + idx * NS;
+#ifdef RASTER_SSE2
+            __m128 z = _mm_set1_ps(zbuffer[x + y * zbuffer_stride]);
+            for (int g = 0; g < NS; g += 4) _mm_storeu_ps(depth + g, z);
+#else
+            for (int k = 0; k < NS; k++) depth[k] = zbuffer[x + y * zbuffer_stride];
+#endif
+            const unsigned char* src = color + (x + y * color_stride) * BPP;
+            unsigned char* dst = slice.color + idx * NS * BPP;
+            for (int k = 0; k < NS; k++) memcpy(dst + k * BPP, src, BPP);
+        }
+    }
+}
+
+template <int NS, int BPP>
+void resolve_kernel(const FrameSlice& slice, unsigned char* color, int color_stride,
+    float* zbuffer, int zbuffer_stride) {
+    for (int y = 0; y < slice.y1 - slice.y0; y++) {
+        int row = y * slice.stride;
+        for (int x = 0; x < slice.x1 - slice.x0; x++) {
+            int idx = row + x;
+            const float* depth = slice.zbuffer + idx * NS;
+#ifdef RASTER_SSE2
+            __m128 z = _mm_loadu_ps(depth);
+            for (int g = 4; g < NS; g += 4) z = _mm_max_ps(z, _mm_loadu_ps(depth + g));
+            z = _mm_max_ps(z, _mm_shuffle_ps(z, z, _MM_SHUFFLE(1, 0, 3, 2)));
+            z = _mm_max_ps(z, _mm_shuffle_ps(z, z, _MM_SHUFFLE(2, 3, 0, 1)));
+            zbuffer[x + y * zbuffer_stride] = _mm_cvtss_f32(z);
+#else
+            float z = depth[0];
+            for (int k = 1; k < NS; k++) z = std::max(z, depth[k]);
+            zbuffer[x + y * zbuffer_stride] = z;
+#endif
+
+            const unsigned char* src = slice.color + idx * NS * BPP;
+            unsigned char* dst = color + (x + y * color_stride) * BPP;
+            // inside a triangle every sample holds the same color, which is also the average
+            if (memcmp(src, src + BPP, (NS - 1) * BPP) == 0) {
+                memcpy(dst, src, BPP);
+                continue;
+            }
+            int sum[BPP];
+            for (int ch = 0; ch < BPP; ch++) sum[ch] = NS / 2;
+            for (int k = 0; k < NS; k++) {
+                for (int ch = 0; ch < BPP; ch++) sum[ch] += src[k * BPP + ch];
+            }
+            for (int ch = 0; ch < BPP; ch++) dst[ch] = (unsigned char)(sum[ch] / NS);
+        }
+    }
+}
+
+// f(NS, BPP) as integral_constants for the slice: 4 or 8 samples, 1, 3 or 4 bytes per pixel
+template <class F>
+void with_sample_layout(const FrameSlice& slice, F f) {
+    if (slice.samples == 8) {
+        if (slice.bytespp == 4) f(std::integral_constant<int, 8>(), std::integral_constant<int, 4>());
+        else if (slice.bytespp == 3) f(std::integral_constant<int, 8>(), std::integral_constant<int, 3>());
+        else f(std::integral_constant<int, 8>(), std::integral_constant<int, 1>());
+    }
+    else {
+        if (slice.bytespp == 4) f(std::integral_constant<int, 4>(), std::integral_constant<int, 4>());
+        else if (slice.bytespp == 3) f(std::integral_constant<int, 4>(), std::integral_constant<int, 3>());
+        else f(std::integral_constant<int, 4>(), std::integral_constant<int, 1>());
+    }
+}
+
+} // namespace
+
+void broadcast_samples(FrameSlice& slice, const unsigned char* color, int color_stride,
+    const float* zbuffer, int zbuffer_stride) {
+    with_sample_layout(slice, [&](auto ns, auto bpp) {
+        broadcast_kernel<decltype(ns)::value, decltype(bpp)::value>(slice, color, color_stride, zbuffer, zbuffer_stride);
+    });
+}
+
+void resolve_samples(const FrameSlice& slice, unsigned char* color, int color_stride,
+    float* zbuffer, int zbuffer_stride) {
+    with_sample_layout(slice, [&](auto ns, auto bpp) {
+        resolve_kernel<decltype(ns)::value, decltype(bpp)::value>(slice, color, color_stride, zbuffer, zbuffer_stride);
+    });
+}
+
+void rasterize(RasterMode mode, const TriangleCmd& tri, int width, int height, FrameSlice& slice) {
+    if (slice.samples > 1) {
+        rasterize_msaa(tri, width, height, slice);
+        return;
+    }
+    if (slice.hiz && hiz_occluded(tri, width, height, slice)) {
+        if (slice.stats) slice.stats->hiz_triangles++;
+        return;
+    }
+    if (mode == RASTER_EDGE) rasterize_edge(tri, width, height, slice);
+    else rasterize_scanline(tri, width, height, slice);
+}
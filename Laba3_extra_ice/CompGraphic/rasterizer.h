@@ -0,0 +1,162 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "hiz_buffer.h"
+#include "abuffer.h"
+
+class ShadowMap;
+
+// Work the hierarchical Z test removed before shading
+struct RasterStats {
+	long long hiz_triangles;  // triangles (per slice) with every covered block in front of them
+	long long hiz_blocks;     // 8x8 blocks skipped inside the edge kernel
+	long long shaded;         // pixels that ran the shading code
+
+	RasterStats() : hiz_triangles(0), hiz_blocks(0), shaded(0) {}
+};
+
+// Supported multisample counts: 1, 4 (rotated grid) and 8
+const int MAX_SAMPLES = 8;
+bool valid_sample_count(int samples);
+
+// Rectangular window into color and depth buffers. For the direct path it covers
+// the whole frame, for the tile renderer it is a tile-local copy.
+struct FrameSlice {
+	int x0, y0;             // first pixel (inclusive) in frame coords
+	int x1, y1;             // last pixel (exclusive) in frame coords
+	int stride;             // pixels per row of color/zbuffer
+	int bytespp;
+	unsigned char* color;
+	float* zbuffer;
+	HiZBuffer* hiz;         // optional, frame-wide, each block is only touched by the slice that owns it
+	RasterStats* stats;     // optional
+	// Visibility buffer, optional. If set, opaque triangles only store their id and
+	// barycentrics per pixel, shade_visibility() shades the survivors afterwards.
+	int* visibility;        // triangle id, -1 if empty
+	float* barycentrics;    // l1, l2 per pixel
+	// Weighted blended OIT targets, optional. If set, transparent triangles don't write
+	// depth and accumulate here instead of blending, resolve_transparency() composites.
+	float* accum;           // premultiplied rgb * weight, alpha * weight per pixel, cleared to 0
+	float* revealage;       // product of (1 - alpha) per pixel, cleared to 1
+	// A-buffer, optional. If set, transparent triangles don't write depth and store
+	// their fragments here, resolve_transparency() sorts and composites them.
+	ABuffer* abuffer;
+	// Samples per pixel. With more than one, color and zbuffer hold that many
+	// consecutive entries per pixel and only the MSAA kernel is used.
+	int samples;
+	// Depth interval of the frame, (z - depth_far) * depth_scale is 0 at the far
+	// plane and 1 at the near one. Weighted OIT weighs fragments by it.
+	float depth_far, depth_scale;
+};
+
+// Per-vertex attributes, interpolated perspective-correct with 1/w.
+// Slot layout is up to the submitter, textured shading reads uv from the first two,
+// per-pixel lighting the rest.
+const int MAX_VARYINGS = 12;
+const int VARYING_U = 0;
+const int VARYING_V = 1;
+const int VARYING_NORMAL = 2;    // x, y, z
+const int VARYING_TANGENT = 5;   // x, y, z, handedness; only with a tangent-space normal map
+const int VARYING_POSITION = 9;  // x, y, z in object space
+const int VARYING_INTENSITY = 2; // Gouraud: diffuse + specular of the vertex
+const int VARYING_SHADOW_POSITION = 3; // textured and Gouraud with a shadow map: x, y, z in object space
+
+// Light and material of the lit shaders. Vectors are in the model's space. For
+// per-pixel lighting the normal map replaces the interpolated normal, the
+// specular map (red channel) the specular factor. With a shadow map everything
+// but the ambient term is scaled by the point's visibility from the light.
+struct Lighting {
+	Vec3f light_dir;  // direction the light travels, normalized
+	Vec3f eye;
+	float ambient;
+	float specular;   // without a specular map
+	int shininess;
+	const ShadowMap* shadow;  // optional
+};
+
+// Fragment shading of a triangle, see shader.h
+enum ShaderKind {
+	SHADER_FLAT,      // color * intensity
+	SHADER_GOURAUD,   // diffuse texture (or color) * interpolated vertex lighting, needs lighting
+	SHADER_TEXTURED,  // diffuse texture * intensity, shadowed if lighting has a shadow map
+	SHADER_PHONG,     // per-pixel lighting with the normal and specular maps, needs lighting
+	SHADER_ICE        // color * intensity blended with the color's alpha, needs is_transparent
+};
+
+// One triangle as submitted by the scene code
+struct TriangleCmd {
+	Vec3f t[3];        // pixel-snapped screen x, y and depth
+	float inv_w[3];    // 1/w of each vertex
+	int nvaryings;
+	float varyings[3][MAX_VARYINGS];
+	float intensity;
+	bool is_transparent;  // drawn after the opaque triangles, must match the shader
+	bool cull_back;    // drop if it faces away from the camera
+	TGAColor color;
+	Model* model;
+	ShaderKind shader;
+	Sampler sampler;   // filtering of the model's texture maps
+	const Lighting* lighting;  // uniforms of the lit shaders, must outlive the frame
+	int id;            // index in the renderer's triangle list, set on submit
+};
+
+enum TransparencyMode {
+	TRANSPARENCY_ORDERED,   // blended in submission order, writes depth
+	TRANSPARENCY_WEIGHTED,  // weighted blended OIT, order independent
+	TRANSPARENCY_ABUFFER    // per-pixel fragment lists sorted by depth, exact
+};
+
+enum RasterMode {
+	RASTER_SCANLINE,  // row spans, reference path
+	RASTER_EDGE       // integer edge functions over 8x8 blocks, SSE2 lanes
+};
+
+TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg);
+
+// Screen-space bounding box of the triangle clamped to the frame.
+// Returns false if the triangle is trivially outside or degenerate.
+bool triangle_bounds(const TriangleCmd& tri, int width, int height,
+	int& xmin, int& ymin, int& xmax, int& ymax);
+
+// Line Sweeping, touches only pixels inside slice
+void rasterize_scanline(const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+// Half-space rasterization, touches only pixels inside slice
+void rasterize_edge(const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+// Depth-only half-space rasterization: reads only tri.t, writes only slice.zbuffer,
+// no shading, no varyings, no hi-Z. Triangles past the edge kernel's coordinate
+// range are skipped.
+void rasterize_depth(const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+// Shades every pixel of slice the visibility buffer points at and clears it.
+// tris is indexed by the stored ids.
+void shade_visibility(const TriangleCmd* tris, FrameSlice& slice);
+
+// Composites the weighted OIT buffers or the A-buffer lists of slice over its color and clears them
+void resolve_transparency(FrameSlice& slice);
+
+// Hierarchical Z test: true if no pixel of the triangle inside slice can pass the depth test
+bool hiz_occluded(const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+// Per-sample coverage and depth, shaded once per pixel, touches only pixels inside slice.
+// Needs slice.samples > 1.
+void rasterize_msaa(const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+// Copies one color/depth per pixel into every sample of slice. color and zbuffer point
+// at the slice's first pixel, their row strides are in pixels.
+void broadcast_samples(FrameSlice& slice, const unsigned char* color, int color_stride,
+	const float* zbuffer, int zbuffer_stride);
+
+// Averages the color samples of slice back into one pixel, depth keeps the nearest sample.
+// Same layout of color and zbuffer as for broadcast_samples.
+void resolve_samples(const FrameSlice& slice, unsigned char* color, int color_stride,
+	float* zbuffer, int zbuffer_stride);
+
+// Runs the hi-Z test if the slice has one, then the selected kernel
+void rasterize(RasterMode mode, const TriangleCmd& tri, int width, int height, FrameSlice& slice);
+
+#endif //__RASTERIZER_H__
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include "renderer.h"
+
+namespace {
+
+// f(id) for every triangle id of the bin
+template <class Bin, class F>
+void for_each_id(const Bin& bin, F f) {
+    for (auto* chunk = bin.head; chunk; chunk = chunk->next) {
+        for (int i = 0; i < chunk->count; i++) f(chunk->ids[i]);
+    }
+}
+
+} // namespace
+
+Renderer::Renderer(int width, int height, bool tiled, RasterMode mode, int nthreads)
+    : width_(width), height_(height), tiled_(tiled), mode_(mode), color_(nullptr), depth_(nullptr),
+      hiz_enabled_(true), deferred_(false), transparency_(TRANSPARENCY_ORDERED),
+      abuffer_bytes_(16 << 20), samples_(1), pool_(tiled ? nthreads : 1) {
+    tiles_x_ = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y_ = (height_ + TILE_SIZE - 1) / TILE_SIZE;
+    bins_.resize(tiles_x_ * tiles_y_, Bin());
+    local_depth_.resize(pool_.size(), std::vector<float>(TILE_SIZE * TILE_SIZE));
+    local_color_.resize(pool_.size(), std::vector<unsigned char>(TILE_SIZE * TILE_SIZE * TGAImage::RGBA));
+    local_tile_color_.resize(pool_.size());
+    local_tile_depth_.resize(pool_.size());
+    local_visibility_.resize(pool_.size(), std::vector<int>(TILE_SIZE * TILE_SIZE, -1));
+    local_barycentrics_.resize(pool_.size(), std::vector<float>(TILE_SIZE * TILE_SIZE * 2));
+    local_accum_.resize(pool_.size(), std::vector<float>(TILE_SIZE * TILE_SIZE * 4, 0.0f));
+    local_revealage_.resize(pool_.size(), std::vector<float>(TILE_SIZE * TILE_SIZE, 1.0f));
+    worker_stats_.resize(pool_.size());
+    hiz_.resize(width_, height_);
+}
+
+void Renderer::begin(ColorBuffer& color, DepthBuffer& depth) {
+    color_ = &color;
+    depth_ = &depth;
+    clip_stats_.reset();
+    for (auto& s : worker_stats_) s = RasterStats();
+    arena_.reset();
+    unsigned char* frame_color = nullptr;
+    if (!tiled_) {
+        frame_color = color.materialize();
+        frame_depth_.resize(width_ * height_);
+        depth.load(frame_depth_.data());
+    }
+    if (use_hiz()) {
+        if (tiled_) hiz_.build(depth, arena_.alloc<float>(TILE_SIZE * TILE_SIZE));
+        else hiz_.build(frame_depth_.data());
+    }
+    tris_.clear();
+    transparent_.clear();
+    for (auto& bin : bins_) bin = Bin();
+    if (use_deferred() && !tiled_ && visibility_.empty()) {
+        visibility_.assign(width_ * height_, -1);
+        barycentrics_.resize(width_ * height_ * 2);
+    }
+    if (transparency_target() == TRANSPARENCY_WEIGHTED && !tiled_ && accum_.empty()) {
+        accum_.assign(width_ * height_ * 4, 0.0f);
+        revealage_.assign(width_ * height_, 1.0f);
+    }
+    if (transparency_target() == TRANSPARENCY_ABUFFER) {
+        abuffer_.resize(width_, height_, abuffer_bytes_);
+        abuffer_.clear();
+    }
+    if (samples_ > 1) {
+        size_t tile = TILE_SIZE * TILE_SIZE * samples_;
+        for (int w = 0; w < pool_.size(); w++) {
+            local_depth_[w].resize(tile);
+            local_color_[w].resize(tile * TGAImage::RGBA);
+            local_tile_color_[w].resize(TILE_SIZE * TILE_SIZE * TGAImage::RGBA);
+            local_tile_depth_[w].resize(TILE_SIZE * TILE_SIZE);
+        }
+        if (!tiled_) {
+            color_samples_.resize(width_ * height_ * samples_ * color.bytespp());
+            depth_samples_.resize(width_ * height_ * samples_);
+            FrameSlice frame = frame_slice();
+            broadcast_samples(frame, frame_color, width_, frame_depth_.data(), width_);
+        }
+    }
+}
+
+FrameSlice Renderer::frame_slice() {
+    FrameSlice frame = { 0, 0, width_, height_, width_, color_->bytespp(), color_->image().buffer(), frame_depth_.data(),
+        use_hiz() ? &hiz_ : nullptr, &worker_stats_[0], nullptr, nullptr, nullptr, nullptr, nullptr, samples_,
+        depth_->farthest(), 1.0f / (depth_->nearest() - depth_->farthest()) };
+    if (samples_ > 1) {
+        frame.color = color_samples_.data();
+        frame.zbuffer = depth_samples_.data();
+    }
+    if (use_deferred()) {
+        frame.visibility = visibility_.data();
+        frame.barycentrics = barycentrics_.data();
+    }
+    if (transparency_target() == TRANSPARENCY_WEIGHTED) {
+        frame.accum = accum_.data();
+        frame.revealage = revealage_.data();
+    }
+    if (transparency_target() == TRANSPARENCY_ABUFFER) frame.abuffer = &abuffer_;
+    return frame;
+}
+
+void Renderer::submit(const TriangleCmd& tri) {
+    if (!tiled_ && !split_transparent()) {
+        FrameSlice frame = frame_slice();
+        rasterize(mode_, tri, width_, height_, frame);
+        return;
+    }
+
+    int xmin, ymin, xmax, ymax;
+    if (!triangle_bounds(tri, width_, height_, xmin, ymin, xmax, ymax)) return;
+
+    int id = (int)tris_.size();
+    tris_.push_back(tri);
+    tris_.back().id = id;
+
+    if (!tiled_) {
+        // opaque now (visibility only if deferred), transparent in flush()
+        if (tri.is_transparent) {
+            transparent_.push_back(id);
+            return;
+        }
+        FrameSlice frame = frame_slice();
+        rasterize(mode_, tris_.back(), width_, height_, frame);
+        return;
+    }
+
+    for (int ty = ymin / TILE_SIZE; ty <= ymax / TILE_SIZE; ty++) {
+        for (int tx = xmin / TILE_SIZE; tx <= xmax / TILE_SIZE; tx++) {
+            Bin& bin = bins_[tx + ty * tiles_x_];
+            if (!bin.tail || bin.tail->count == BinChunk::SIZE) {
+                BinChunk* chunk = arena_.alloc<BinChunk>(1);
+                chunk->next = nullptr;
+                chunk->count = 0;
+                if (bin.tail) bin.tail->next = chunk;
+                else bin.head = chunk;
+                bin.tail = chunk;
+            }
+            bin.tail->ids[bin.tail->count++] = id;
+        }
+    }
+}
+
+void Renderer::draw(VertexCache& cache, const int idx[3], const TriangleCmd& tri) {
+    TriangleCmd clipped[MAX_CLIP_TRIANGLES];
+    int n = clip_triangle(cache, idx, tri, width_, height_, clipped, clip_stats_);
+    for (int i = 0; i < n; i++) submit(clipped[i]);
+}
+
+void Renderer::render_tile(int tile, int worker) {
+    const Bin& bin = bins_[tile];
+    if (!bin.head) return;
+
+    int bpp = color_->bytespp();
+    FrameSlice slice;
+    slice.x0 = (tile % tiles_x_) * TILE_SIZE;
+    slice.y0 = (tile / tiles_x_) * TILE_SIZE;
+    slice.x1 = std::min(slice.x0 + TILE_SIZE, width_);
+    slice.y1 = std::min(slice.y0 + TILE_SIZE, height_);
+    slice.stride = TILE_SIZE;
+    slice.bytespp = bpp;
+    slice.color = local_color_[worker].data();
+    slice.zbuffer = local_depth_[worker].data();
+    slice.hiz = use_hiz() ? &hiz_ : nullptr;
+    slice.stats = &worker_stats_[worker];
+    slice.samples = samples_;
+    slice.depth_far = depth_->farthest();
+    slice.depth_scale = 1.0f / (depth_->nearest() - depth_->farthest());
+
+    if (samples_ > 1) {
+        unsigned char* tile_color = local_tile_color_[worker].data();
+        float* tile_depth = local_tile_depth_[worker].data();
+        color_->load_tile(tile, tile_color, TILE_SIZE);
+        depth_->load_tile(tile, tile_depth, TILE_SIZE);
+        broadcast_samples(slice, tile_color, TILE_SIZE, tile_depth, TILE_SIZE);
+    }
+    else {
+        color_->load_tile(tile, slice.color, TILE_SIZE);
+        depth_->load_tile(tile, slice.zbuffer, TILE_SIZE);
+    }
+
+    slice.visibility = use_deferred() ? local_visibility_[worker].data() : nullptr;
+    slice.barycentrics = use_deferred() ? local_barycentrics_[worker].data() : nullptr;
+    bool weighted = transparency_target() == TRANSPARENCY_WEIGHTED;
+    slice.accum = weighted ? local_accum_[worker].data() : nullptr;
+    slice.revealage = weighted ? local_revealage_[worker].data() : nullptr;
+    slice.abuffer = transparency_target() == TRANSPARENCY_ABUFFER ? &abuffer_ : nullptr;
+
+    if (split_transparent()) {
+        for_each_id(bin, [&](int id) {
+            if (!tris_[id].is_transparent) rasterize(mode_, tris_[id], width_, height_, slice);
+        });
+        if (use_deferred()) shade_visibility(tris_.data(), slice);
+        for_each_id(bin, [&](int id) {
+            if (tris_[id].is_transparent) rasterize(mode_, tris_[id], width_, height_, slice);
+        });
+        resolve_transparency(slice);
+    }
+    else {
+        for_each_id(bin, [&](int id) {
+            rasterize(mode_, tris_[id], width_, height_, slice);
+        });
+    }
+
+    if (samples_ > 1) {
+        unsigned char* tile_color = local_tile_color_[worker].data();
+        float* tile_depth = local_tile_depth_[worker].data();
+        resolve_samples(slice, tile_color, TILE_SIZE, tile_depth, TILE_SIZE);
+        color_->store_tile(tile, tile_color, TILE_SIZE);
+        depth_->store_tile(tile, tile_depth, TILE_SIZE);
+        return;
+    }
+    color_->store_tile(tile, slice.color, TILE_SIZE);
+    depth_->store_tile(tile, slice.zbuffer, TILE_SIZE);
+}
+
+RasterStats Renderer::raster_stats() const {
+    RasterStats total;
+    for (const auto& s : worker_stats_) {
+        total.hiz_triangles += s.hiz_triangles;
+        total.hiz_blocks += s.hiz_blocks;
+        total.shaded += s.shaded;
+    }
+    return total;
+}
+
+void Renderer::flush() {
+    if (!tiled_) {
+        FrameSlice frame = frame_slice();
+        if (samples_ > 1) {
+            resolve_samples(frame, color_->image().buffer(), width_, frame_depth_.data(), width_);
+        }
+        else if (split_transparent()) {
+            if (use_deferred()) shade_visibility(tris_.data(), frame);
+            for (int id : transparent_) rasterize(mode_, tris_[id], width_, height_, frame);
+            resolve_transparency(frame);
+            tris_.clear();
+            transparent_.clear();
+        }
+        depth_->store(frame_depth_.data());
+        return;
+    }
+    if (!tris_.empty()) {
+        pool_.parallel_for(tiles_x_ * tiles_y_, [this](int tile, int worker) { render_tile(tile, worker); });
+        tris_.clear();
+        for (auto& bin : bins_) bin = Bin();
+    }
+    color_->resolve();
+}
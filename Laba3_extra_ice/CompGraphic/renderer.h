@@ -0,0 +1,126 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include <vector>
+#include "rasterizer.h"
+#include "clipper.h"
+#include "color_buffer.h"
+#include "depth_buffer.h"
+#include "thread_pool.h"
+#include "frame_arena.h"
+
+// Collects the triangles of one frame and rasterizes them either immediately
+// (reference single-threaded path) or binned into screen tiles that are
+// rasterized in parallel, each in a tile-local color/depth slice.
+//
+// In deferred mode opaque triangles only write depth and a visibility buffer
+// (triangle id + barycentrics), every visible pixel is shaded once afterwards.
+// Transparent triangles are blended after that shading pass, so they must be
+// submitted after the opaque triangles they cover.
+//
+// With TRANSPARENCY_WEIGHTED transparent triangles go to weighted blended OIT
+// buffers after all opaque work of the tile and are resolved at the end, so
+// their submission order doesn't matter. TRANSPARENCY_ABUFFER stores them as
+// per-pixel fragment lists instead and composites them sorted by depth.
+//
+// With 4 or 8 samples per pixel (MSAA) every tile keeps per-sample color and
+// depth, shades once per pixel and resolves into the image at the end. MSAA
+// renders forward with ordered transparency and no hi-Z, the other modes are
+// ignored while it is on.
+//
+// Color and depth live in a ColorBuffer and a DepthBuffer. Tiles load their
+// part into tile buffers and store it back, so they line up with the clear and
+// compression tiles of both and a cleared tile is never read from memory.
+// The direct path materializes the whole frame on begin() and stores the depth
+// on flush().
+//
+// Per-frame scratch (tile bins, the hi-Z rebuild tile) comes from a frame
+// arena that begin() resets; callers may take their own frame data from it too.
+class Renderer {
+public:
+	static const int TILE_SIZE = DepthBuffer::TILE_SIZE; // same as ColorBuffer::TILE_SIZE
+
+	Renderer(int width, int height, bool tiled = true, RasterMode mode = RASTER_SCANLINE, int nthreads = 0);
+	void begin(ColorBuffer& color, DepthBuffer& depth);
+	void submit(const TriangleCmd& tri);
+	// clips triangle idx[0..2] of the cache and submits what is left,
+	// tri carries shading state and varyings, its positions are filled in here
+	void draw(VertexCache& cache, const int idx[3], const TriangleCmd& tri);
+	void flush(); // must be called before reading color/depth, resolves color
+	bool tiled() const { return tiled_; }
+	RasterMode mode() const { return mode_; }
+	int threads() const { return pool_.size(); }
+	const ClipStats& clip_stats() const { return clip_stats_; } // since begin()
+	RasterStats raster_stats() const;                            // since begin(), valid after flush()
+	void set_hiz(bool enabled) { hiz_enabled_ = enabled; }
+	bool hiz() const { return hiz_enabled_; }
+	void set_deferred(bool enabled) { deferred_ = enabled; }
+	bool deferred() const { return deferred_; }
+	void set_transparency(TransparencyMode mode) { transparency_ = mode; }
+	TransparencyMode transparency() const { return transparency_; }
+	void set_abuffer_limit(size_t bytes) { abuffer_bytes_ = bytes; } // fragment pool cap, applied on begin()
+	const ABuffer& abuffer() const { return abuffer_; }
+	void set_samples(int samples) { samples_ = samples; } // 1, 4 or 8, see valid_sample_count()
+	int samples() const { return samples_; }
+	// transient memory of the current frame, valid until the next begin()
+	FrameArena& arena() { return arena_; }
+	const FrameArena& arena() const { return arena_; }
+private:
+	// triangle ids of one tile, in submission order; chunks come from the arena
+	struct BinChunk {
+		static const int SIZE = 62;
+		BinChunk* next;
+		int count;
+		int ids[SIZE];
+	};
+	struct Bin {
+		BinChunk* head;
+		BinChunk* tail;
+	};
+
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	bool tiled_;
+	RasterMode mode_;
+	ColorBuffer* color_;
+	DepthBuffer* depth_;
+	ClipStats clip_stats_;
+	bool hiz_enabled_;
+	bool deferred_;
+	TransparencyMode transparency_;
+	size_t abuffer_bytes_;
+	int samples_;
+	ABuffer abuffer_;
+	HiZBuffer hiz_;
+	std::vector<RasterStats> worker_stats_;
+	std::vector<TriangleCmd> tris_;
+	std::vector<Bin> bins_;                  // per tile
+	FrameArena arena_;
+	ThreadPool pool_;
+	std::vector<std::vector<float> > local_depth_;          // per worker
+	std::vector<std::vector<unsigned char> > local_color_;  // per worker
+	std::vector<std::vector<unsigned char> > local_tile_color_; // per worker, MSAA: tile before broadcast/after resolve
+	std::vector<std::vector<float> > local_tile_depth_;
+	std::vector<std::vector<int> > local_visibility_;       // per worker, deferred mode
+	std::vector<std::vector<float> > local_barycentrics_;   // per worker, deferred mode
+	std::vector<std::vector<float> > local_accum_;          // per worker, weighted OIT
+	std::vector<std::vector<float> > local_revealage_;      // per worker, weighted OIT
+	std::vector<float> frame_depth_;                        // frame, direct path
+	std::vector<int> visibility_;                           // frame, deferred direct path
+	std::vector<float> barycentrics_;
+	std::vector<float> accum_;                              // frame, weighted OIT direct path
+	std::vector<float> revealage_;
+	std::vector<int> transparent_;                          // direct path, waiting for the opaque work
+	std::vector<unsigned char> color_samples_;              // frame, MSAA direct path
+	std::vector<float> depth_samples_;
+
+	// transparent triangles wait until the opaque ones are done
+	bool split_transparent() const { return use_deferred() || transparency_target() != TRANSPARENCY_ORDERED; }
+	bool use_hiz() const { return hiz_enabled_ && samples_ == 1; }
+	bool use_deferred() const { return deferred_ && samples_ == 1; }
+	TransparencyMode transparency_target() const { return samples_ == 1 ? transparency_ : TRANSPARENCY_ORDERED; }
+	FrameSlice frame_slice();
+	void render_tile(int tile, int worker);
+};
+
+#endif //__RENDERER_H__
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include "shader.h"
+
+namespace {
+
+// Texels the lighting reads, channels 0..255 as floats, one array entry per lane
+struct PhongTexels {
+    float r[4], g[4], b[4];     // diffuse
+    float nx[4], ny[4], nz[4];  // normal map, still encoded
+    float spec[4];              // specular factor 0..1
+};
+
+// u, v hold all four lanes of the quad, the mip level of each map comes once
+// from their differences, as in TexturedShader::texels()
+void fetch_phong_texels(const TriangleCmd& tri, int lanes, const float* u, const float* v, PhongTexels& t) {
+    const Model& model = *tri.model;
+    const Texture2D* maps[3] = { &model.diffuse_map(), &model.normal_map(), &model.specular_map() };
+    float lod[3] = { 0.0f, 0.0f, 0.0f };
+    if (tri.sampler.filter != FILTER_POINT) {
+        float dudx = u[1] - u[0], dvdx = v[1] - v[0], dudy = u[2] - u[0], dvdy = v[2] - v[0];
+        for (int m = 0; m < 3; m++) {
+            if (!maps[m]->empty()) lod[m] = maps[m]->lod(dudx, dvdx, dudy, dvdy);
+        }
+    }
+    for (int l = 0; l < 4; l++) {
+        if (!(lanes & (1 << l))) continue;
+        TGAColor c;
+        if (!maps[0]->empty()) c = maps[0]->sample(tri.sampler, u[l], v[l], lod[0]);
+        t.r[l] = c.r;
+        t.g[l] = c.g;
+        t.b[l] = c.b;
+        if (!maps[1]->empty()) {
+            c = maps[1]->sample(tri.sampler, u[l], v[l], lod[1]);
+            t.nx[l] = c.r;
+            t.ny[l] = c.g;
+            t.nz[l] = c.b;
+        }
+        t.spec[l] = maps[2]->empty() ? tri.lighting->specular
+            : maps[2]->sample(tri.sampler, u[l], v[l], lod[2]).r * (1.0f / 255.0f);
+    }
+}
+
+#ifdef RASTER_SSE2
+
+// Four 3D vectors, one per lane
+struct Vec3x4 {
+    __m128 x, y, z;
+};
+
+inline __m128 dot(const Vec3x4& a, const Vec3x4& b) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+inline Vec3x4 scale(const Vec3x4& a, __m128 f) {
+    Vec3x4 r = { _mm_mul_ps(a.x, f), _mm_mul_ps(a.y, f), _mm_mul_ps(a.z, f) };
+    return r;
+}
+
+inline Vec3x4 normalized(const Vec3x4& a) {
+    __m128 len = _mm_sqrt_ps(_mm_max_ps(dot(a, a), _mm_set1_ps(1e-20f)));
+    return scale(a, _mm_div_ps(_mm_set1_ps(1.0f), len));
+}
+
+// x^n by squaring, n >= 0
+inline __m128 pow_int(__m128 x, int n) {
+    __m128 r = _mm_set1_ps(1.0f);
+    for (; n > 0; n >>= 1) {
+        if (n & 1) r = _mm_mul_ps(r, x);
+        x = _mm_mul_ps(x, x);
+    }
+    return r;
+}
+
+#else
+
+inline float pow_int(float x, int n) {
+    float r = 1.0f;
+    for (; n > 0; n >>= 1) {
+        if (n & 1) r *= x;
+        x *= x;
+    }
+    return r;
+}
+
+#endif
+
+} // namespace
+
+// Texture fetches and shadow lookups go lane by lane, interpolation, normal
+// mapping and lighting run on all four lanes of the quad at once. out is left as is for unset lanes.
+void shade_phong(const TriangleCmd& tri, int lanes, const float* l1, const float* l2, TGAColor* out) {
+    const Lighting& light = *tri.lighting;
+    const bool normal_map = !tri.model->normal_map().empty();
+    const bool tangent_space = normal_map && tri.model->tangent_normals();
+    const int nv = tri.nvaryings;
+    PhongTexels t = {};
+    float r[4], g[4], b[4];
+
+#ifdef RASTER_SSE2
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 b1 = _mm_loadu_ps(l1), b2 = _mm_loadu_ps(l2);
+    __m128 p0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, b1), b2), _mm_set1_ps(tri.inv_w[0]));
+    __m128 p1 = _mm_mul_ps(b1, _mm_set1_ps(tri.inv_w[1]));
+    __m128 p2 = _mm_mul_ps(b2, _mm_set1_ps(tri.inv_w[2]));
+    __m128 norm = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(p0, p1), p2));
+    p0 = _mm_mul_ps(p0, norm);
+    p1 = _mm_mul_ps(p1, norm);
+    p2 = _mm_mul_ps(p2, norm);
+    __m128 var[MAX_VARYINGS];
+    for (int k = 0; k < nv; k++) {
+        var[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(tri.varyings[0][k])),
+            _mm_mul_ps(p1, _mm_set1_ps(tri.varyings[1][k]))), _mm_mul_ps(p2, _mm_set1_ps(tri.varyings[2][k])));
+    }
+
+    float u[4], v[4];
+    _mm_storeu_ps(u, var[VARYING_U]);
+    _mm_storeu_ps(v, var[VARYING_V]);
+    fetch_phong_texels(tri, lanes, u, v, t);
+
+    Vec3x4 n = { var[VARYING_NORMAL], var[VARYING_NORMAL + 1], var[VARYING_NORMAL + 2] };
+    n = normalized(n);
+    if (normal_map) {
+        const __m128 k = _mm_set1_ps(2.0f / 255.0f);
+        Vec3x4 m = { _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(t.nx), k), one),
+            _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(t.ny), k), one),
+            _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(t.nz), k), one) };
+        if (tangent_space) {
+            // re-orthogonalize the interpolated frame, B = handedness * N x T
+            Vec3x4 tg = { var[VARYING_TANGENT], var[VARYING_TANGENT + 1], var[VARYING_TANGENT + 2] };
+            __m128 nt = dot(n, tg);
+            tg.x = _mm_sub_ps(tg.x, _mm_mul_ps(n.x, nt));
+            tg.y = _mm_sub_ps(tg.y, _mm_mul_ps(n.y, nt));
+            tg.z = _mm_sub_ps(tg.z, _mm_mul_ps(n.z, nt));
+            tg = normalized(tg);
+            __m128 sign = _mm_or_ps(_mm_and_ps(var[VARYING_TANGENT + 3], _mm_set1_ps(-0.0f)), one);
+            Vec3x4 bt = { _mm_sub_ps(_mm_mul_ps(n.y, tg.z), _mm_mul_ps(n.z, tg.y)),
+                _mm_sub_ps(_mm_mul_ps(n.z, tg.x), _mm_mul_ps(n.x, tg.z)),
+                _mm_sub_ps(_mm_mul_ps(n.x, tg.y), _mm_mul_ps(n.y, tg.x)) };
+            bt = scale(bt, sign);
+            Vec3x4 mapped = {
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(tg.x, m.x), _mm_mul_ps(bt.x, m.y)), _mm_mul_ps(n.x, m.z)),
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(tg.y, m.x), _mm_mul_ps(bt.y, m.y)), _mm_mul_ps(n.y, m.z)),
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(tg.z, m.x), _mm_mul_ps(bt.z, m.y)), _mm_mul_ps(n.z, m.z)) };
+            m = mapped;
+        }
+        n = normalized(m);
+    }
+
+    // l points towards the light, r is its reflection about n
+    Vec3x4 l = { _mm_set1_ps(-light.light_dir.x), _mm_set1_ps(-light.light_dir.y), _mm_set1_ps(-light.light_dir.z) };
+    __m128 nl = dot(n, l);
+    __m128 diffuse = _mm_max_ps(nl, zero);
+    __m128 twice_nl = _mm_add_ps(nl, nl);
+    Vec3x4 refl = { _mm_sub_ps(_mm_mul_ps(n.x, twice_nl), l.x), _mm_sub_ps(_mm_mul_ps(n.y, twice_nl), l.y),
+        _mm_sub_ps(_mm_mul_ps(n.z, twice_nl), l.z) };
+    Vec3x4 view = { _mm_sub_ps(_mm_set1_ps(light.eye.x), var[VARYING_POSITION]),
+        _mm_sub_ps(_mm_set1_ps(light.eye.y), var[VARYING_POSITION + 1]),
+        _mm_sub_ps(_mm_set1_ps(light.eye.z), var[VARYING_POSITION + 2]) };
+    view = normalized(view);
+    __m128 spec = pow_int(_mm_max_ps(dot(refl, view), zero), light.shininess);
+    // no highlight on the side facing away from the light
+    spec = _mm_and_ps(_mm_cmpgt_ps(nl, zero), _mm_mul_ps(spec, _mm_loadu_ps(t.spec)));
+    if (light.shadow) {
+        float px[4], py[4], pz[4], vis[4];
+        _mm_storeu_ps(px, var[VARYING_POSITION]);
+        _mm_storeu_ps(py, var[VARYING_POSITION + 1]);
+        _mm_storeu_ps(pz, var[VARYING_POSITION + 2]);
+        for (int i = 0; i < 4; i++) {
+            vis[i] = (lanes & (1 << i)) ? light.shadow->visibility(Vec3f(px[i], py[i], pz[i])) : 1.0f;
+        }
+        __m128 v = _mm_loadu_ps(vis);
+        diffuse = _mm_mul_ps(diffuse, v);
+        spec = _mm_mul_ps(spec, v);
+    }
+
+    __m128 lit = _mm_min_ps(one, _mm_add_ps(_mm_set1_ps(light.ambient), diffuse));
+    __m128 highlight = _mm_mul_ps(spec, _mm_set1_ps(255.0f));
+    __m128 limit = _mm_set1_ps(255.0f);
+    _mm_storeu_ps(r, _mm_min_ps(limit, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t.r), lit), highlight)));
+    _mm_storeu_ps(g, _mm_min_ps(limit, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t.g), lit), highlight)));
+    _mm_storeu_ps(b, _mm_min_ps(limit, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t.b), lit), highlight)));
+#else
+    float var[4][MAX_VARYINGS];
+    float u[4], v[4];
+    // every lane, the texel fetch takes the derivatives from them
+    for (int i = 0; i < 4; i++) {
+        interpolate_varyings(tri, l1[i], l2[i], var[i], nv);
+        u[i] = var[i][VARYING_U];
+        v[i] = var[i][VARYING_V];
+    }
+    fetch_phong_texels(tri, lanes, u, v, t);
+
+    Vec3f l = light.light_dir * -1.0f;
+    for (int i = 0; i < 4; i++) {
+        if (!(lanes & (1 << i))) continue;
+        const float* vi = var[i];
+        Vec3f n(vi[VARYING_NORMAL], vi[VARYING_NORMAL + 1], vi[VARYING_NORMAL + 2]);
+        n.normalize();
+        if (normal_map) {
+            Vec3f m(t.nx[i] * (2.0f / 255.0f) - 1.0f, t.ny[i] * (2.0f / 255.0f) - 1.0f, t.nz[i] * (2.0f / 255.0f) - 1.0f);
+            if (tangent_space) {
+                Vec3f tg(vi[VARYING_TANGENT], vi[VARYING_TANGENT + 1], vi[VARYING_TANGENT + 2]);
+                tg = tg - n * (n * tg);
+                tg.normalize();
+                Vec3f bt = (n ^ tg) * (vi[VARYING_TANGENT + 3] < 0.0f ? -1.0f : 1.0f);
+                m = tg * m.x + bt * m.y + n * m.z;
+            }
+            n = m.normalize();
+        }
+        float nl = n * l;
+        Vec3f refl = n * (2.0f * nl) - l;
+        Vec3f view = light.eye - Vec3f(vi[VARYING_POSITION], vi[VARYING_POSITION + 1], vi[VARYING_POSITION + 2]);
+        view.normalize();
+        float spec = nl > 0.0f ? pow_int(std::max(0.0f, refl * view), light.shininess) * t.spec[i] : 0.0f;
+        float diffuse = std::max(0.0f, nl);
+        if (light.shadow) {
+            float vis = light.shadow->visibility(Vec3f(vi[VARYING_POSITION], vi[VARYING_POSITION + 1], vi[VARYING_POSITION + 2]));
+            diffuse *= vis;
+            spec *= vis;
+        }
+        float lit = std::min(1.0f, light.ambient + diffuse);
+        r[i] = std::min(255.0f, t.r[i] * lit + spec * 255.0f);
+        g[i] = std::min(255.0f, t.g[i] * lit + spec * 255.0f);
+        b[i] = std::min(255.0f, t.b[i] * lit + spec * 255.0f);
+    }
+#endif
+
+    for (int i = 0; i < 4; i++) {
+        if (lanes & (1 << i)) out[i] = TGAColor((unsigned char)r[i], (unsigned char)g[i], (unsigned char)b[i], 255);
+    }
+}
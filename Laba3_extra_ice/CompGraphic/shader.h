@@ -0,0 +1,313 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <algorithm>
+#include "rasterizer.h"
+#include "shadow_map.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Done once per triangle. Barycentrics of vertices 1 and 2 are plane equations
+// in absolute pixel coordinates, so every pixel gets the same values no matter
+// which slice (tile) it is rasterized in.
+struct TriangleSetup {
+	float l1x, l1y, l1c;   // l1 = l1x*x + l1y*y + l1c
+	float l2x, l2y, l2c;
+	float z0, dz1, dz2;    // z = z0 + l1*dz1 + l2*dz2
+};
+
+inline bool setup_triangle(const TriangleCmd& tri, TriangleSetup& s) {
+	const Vec3f& v0 = tri.t[0];
+	const Vec3f& v1 = tri.t[1];
+	const Vec3f& v2 = tri.t[2];
+
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area == 0.0f) return false;
+	float inv_area = 1.0f / area;
+
+	// l1 is the edge function of v2->v0, l2 of v0->v1, both divided by the area
+	s.l1x = (v2.y - v0.y) * inv_area;
+	s.l1y = (v0.x - v2.x) * inv_area;
+	s.l1c = (v2.x * v0.y - v2.y * v0.x) * inv_area;
+	s.l2x = (v0.y - v1.y) * inv_area;
+	s.l2y = (v1.x - v0.x) * inv_area;
+	s.l2c = (v0.x * v1.y - v0.y * v1.x) * inv_area;
+
+	s.z0 = v0.z;
+	s.dz1 = v1.z - v0.z;
+	s.dz2 = v2.z - v0.z;
+	return true;
+}
+
+// Perspective-correct varyings from screen-space barycentrics, the first count of them
+inline void interpolate_varyings(const TriangleCmd& tri, float l1, float l2, float* out, int count) {
+	float p0 = (1.0f - l1 - l2) * tri.inv_w[0];
+	float p1 = l1 * tri.inv_w[1];
+	float p2 = l2 * tri.inv_w[2];
+	float norm = 1.0f / (p0 + p1 + p2);
+	p0 *= norm;
+	p1 *= norm;
+	p2 *= norm;
+	for (int k = 0; k < count; k++) {
+		out[k] = p0 * tri.varyings[0][k] + p1 * tri.varyings[1][k] + p2 * tri.varyings[2][k];
+	}
+}
+
+// The 2x2 quad holding pixel (x, y), for shaders that work on quads: lane l
+// is pixel ((x & ~1) + (l & 1), (y & ~1) + (l >> 1)), its barycentrics are
+// stepped from (l1, l2) along the planes of s. Returns the lane of (x, y).
+inline int pixel_quad(const TriangleSetup& s, float l1, float l2, int x, int y, float b1[4], float b2[4]) {
+	for (int l = 0; l < 4; l++) {
+		float dx = (float)((l & 1) - (x & 1)), dy = (float)((l >> 1) - (y & 1));
+		b1[l] = l1 + s.l1x * dx + s.l1y * dy;
+		b2[l] = l2 + s.l2x * dx + s.l2y * dy;
+	}
+	return (x & 1) + 2 * (y & 1);
+}
+
+// Visibility from the light at the interpolated VARYING_SHADOW_POSITION
+inline float shadow_visibility(const ShadowMap& shadow, const float* v) {
+	return shadow.visibility(Vec3f(v[VARYING_SHADOW_POSITION], v[VARYING_SHADOW_POSITION + 1], v[VARYING_SHADOW_POSITION + 2]));
+}
+
+// Vertex stage input, model space
+struct ShaderVertex {
+	Vec3f position;
+	Vec3f normal;
+	Vec4f tangent;   // xyz + handedness, see Model::tangent()
+	Vec2f uv;
+};
+
+// The rasterizer kernels are templates over the shader type. rasterize() picks
+// the instantiation once per triangle from TriangleCmd::shader, the pixel loops
+// then run one shader without branching on the kind of triangle, and the
+// shader's per-triangle state is a local of the kernel. A shader provides
+//
+//   S(const TriangleCmd& tri, const TriangleSetup& s)  per-triangle state
+//   static const bool transparent  fragments are blended, see TransparencyMode
+//   static const bool batched      fragment_quad() is cheaper than four fragment() calls
+//   TGAColor fragment(float l1, float l2, int x, int y) const
+//   void fragment_quad(int x, int y, int lanes, const float* l1, const float* l2, TGAColor* out) const
+//   static int vertex(const ShaderVertex& v, const Lighting& u, float* varyings)
+//
+// l1, l2 are the barycentrics of vertices 1 and 2 at pixel (x, y). fragment_quad()
+// shades the 2x2 quad with its top-left pixel at (x, y), both even: lane l is
+// pixel (x + (l & 1), y + (l >> 1)) and is shaded if bit l of lanes is set.
+// l1, l2 hold all four lanes, extrapolated for pixels outside the triangle, so
+// the shader can take derivatives from the differences between lanes as
+// hardware does. vertex() is run by the scene code for each vertex of a
+// triangle, it writes the varyings and returns their count. ShaderBase fills
+// in what a shader leaves out.
+template <class S>
+struct ShaderBase {
+	static const bool transparent = false;
+	static const bool batched = false;
+
+	void fragment_quad(int x, int y, int lanes, const float* l1, const float* l2, TGAColor* out) const {
+		for (int l = 0; l < 4; l++) {
+			if (lanes & (1 << l)) out[l] = static_cast<const S*>(this)->fragment(l1[l], l2[l], x + (l & 1), y + (l >> 1));
+		}
+	}
+	static int vertex(const ShaderVertex&, const Lighting&, float*) { return 0; }
+};
+
+inline TGAColor scale_rgb(TGAColor color, float f) {
+	color.r = (unsigned char)(color.r * f);
+	color.g = (unsigned char)(color.g * f);
+	color.b = (unsigned char)(color.b * f);
+	return color;
+}
+
+// Triangle color scaled by its intensity
+struct FlatShader : ShaderBase<FlatShader> {
+	TGAColor color;
+
+	FlatShader(const TriangleCmd& tri, const TriangleSetup&) : color(scale_rgb(tri.color, tri.intensity)) {}
+	TGAColor fragment(float, float, int, int) const { return color; }
+};
+
+// Flat and blended with the triangle's alpha, the ice of the sphere
+struct IceShader : FlatShader {
+	static const bool transparent = true;
+
+	IceShader(const TriangleCmd& tri, const TriangleSetup& s) : FlatShader(tri, s) {}
+};
+
+// Model's diffuse texture scaled by the triangle's intensity. In shadow only
+// the ambient part of the intensity is left. Shades 2x2 quads, the texture LOD
+// is taken once per quad from the differences between its lanes.
+struct TexturedShader : ShaderBase<TexturedShader> {
+	static const bool batched = true;
+	const TriangleCmd& tri;
+	const TriangleSetup& setup;
+	const Texture2D* tex;  // null without a model
+	const ShadowMap* shadow;  // null without shadows
+
+	TexturedShader(const TriangleCmd& tri, const TriangleSetup& s)
+		: tri(tri), setup(s), tex(tri.model ? &tri.model->diffuse_map() : nullptr),
+		  shadow(tri.lighting ? tri.lighting->shadow : nullptr) {}
+	// a lone pixel still needs its quad for the LOD
+	TGAColor fragment(float l1, float l2, int x, int y) const {
+		float b1[4], b2[4];
+		int lane = pixel_quad(setup, l1, l2, x, y, b1, b2);
+		TGAColor colors[4];
+		fragment_quad(x & ~1, y & ~1, 1 << lane, b1, b2, colors);
+		return colors[lane];
+	}
+	void fragment_quad(int, int, int lanes, const float* l1, const float* l2, TGAColor* out) const {
+		// u, v of every lane for the LOD, the shadow position only where shaded
+		float var[4][VARYING_SHADOW_POSITION + 3];
+		float u[4], v[4];
+		for (int l = 0; l < 4; l++) {
+			interpolate_varyings(tri, l1[l], l2[l], var[l], shadow && (lanes & (1 << l)) ? VARYING_SHADOW_POSITION + 3 : 2);
+			u[l] = var[l][VARYING_U];
+			v[l] = var[l][VARYING_V];
+		}
+		texels(lanes, u, v, out);
+		for (int l = 0; l < 4; l++) {
+			if (!(lanes & (1 << l))) continue;
+			float intensity = tri.intensity;
+			if (shadow) {
+				float ambient = std::min(intensity, tri.lighting->ambient);
+				intensity = ambient + (intensity - ambient) * shadow_visibility(*shadow, var[l]);
+			}
+			out[l] = scale_rgb(out[l], intensity);
+		}
+	}
+	// diffuse texels of the shaded lanes at (u[l], v[l]), black without a
+	// texture; u, v hold all four lanes
+	void texels(int lanes, const float* u, const float* v, TGAColor* out) const {
+		bool empty = !tex || tex->empty();
+		float lod = 0.0f;
+		if (!empty && tri.sampler.filter != FILTER_POINT) {
+			lod = tex->lod(u[1] - u[0], v[1] - v[0], u[2] - u[0], v[2] - v[0]);
+		}
+		for (int l = 0; l < 4; l++) {
+			if (lanes & (1 << l)) out[l] = empty ? TGAColor() : tex->sample(tri.sampler, u[l], v[l], lod);
+		}
+	}
+	static int vertex(const ShaderVertex& v, const Lighting& u, float* varyings) {
+		varyings[VARYING_U] = v.uv.x;
+		varyings[VARYING_V] = v.uv.y;
+		if (!u.shadow) return 2;
+		varyings[VARYING_INTENSITY] = 0.0f;  // unused
+		for (int k = 0; k < 3; k++) varyings[VARYING_SHADOW_POSITION + k] = v.position[k];
+		return VARYING_SHADOW_POSITION + 3;
+	}
+};
+
+// Lighting computed per vertex and interpolated, times the diffuse texture
+// (the triangle color for triangles without a model). The ambient term is
+// added per pixel, after the shadow test.
+struct GouraudShader : ShaderBase<GouraudShader> {
+	static const bool batched = true;
+	TexturedShader textured;
+
+	GouraudShader(const TriangleCmd& tri, const TriangleSetup& s) : textured(tri, s) {}
+	TGAColor fragment(float l1, float l2, int x, int y) const {
+		float b1[4], b2[4];
+		int lane = pixel_quad(textured.setup, l1, l2, x, y, b1, b2);
+		TGAColor colors[4];
+		fragment_quad(x & ~1, y & ~1, 1 << lane, b1, b2, colors);
+		return colors[lane];
+	}
+	// the texture LOD once per quad as in TexturedShader
+	void fragment_quad(int, int, int lanes, const float* l1, const float* l2, TGAColor* out) const {
+		const TriangleCmd& tri = textured.tri;
+		const int count = textured.shadow ? VARYING_SHADOW_POSITION + 3 : 3;
+		float var[4][VARYING_SHADOW_POSITION + 3];
+		float u[4], v[4];
+		for (int l = 0; l < 4; l++) {
+			if (lanes & (1 << l)) interpolate_varyings(tri, l1[l], l2[l], var[l], count);
+			else if (tri.model) interpolate_varyings(tri, l1[l], l2[l], var[l], 2);
+			else continue;
+			u[l] = var[l][VARYING_U];
+			v[l] = var[l][VARYING_V];
+		}
+		if (tri.model) textured.texels(lanes, u, v, out);
+		for (int l = 0; l < 4; l++) {
+			if (!(lanes & (1 << l))) continue;
+			float lit = var[l][VARYING_INTENSITY];
+			if (textured.shadow) lit *= shadow_visibility(*textured.shadow, var[l]);
+			out[l] = scale_rgb(tri.model ? out[l] : tri.color, std::min(1.0f, tri.lighting->ambient + lit));
+		}
+	}
+	// diffuse + specular at the vertex, the terms of PhongShader without the maps
+	static int vertex(const ShaderVertex& v, const Lighting& u, float* varyings) {
+		Vec3f l = u.light_dir * -1.0f;
+		Vec3f view = u.eye - v.position;
+		view.normalize();
+		float nl = v.normal * l;
+		float spec = 0.0f;
+		if (nl > 0.0f) {
+			Vec3f r = v.normal * (2.0f * nl) - l;
+			float x = std::max(0.0f, r * view), p = 1.0f;
+			for (int n = u.shininess; n > 0; n >>= 1, x *= x) {
+				if (n & 1) p *= x;
+			}
+			spec = u.specular * p;
+		}
+		varyings[VARYING_U] = v.uv.x;
+		varyings[VARYING_V] = v.uv.y;
+		varyings[VARYING_INTENSITY] = std::max(0.0f, nl) + spec;
+		if (!u.shadow) return 3;
+		for (int k = 0; k < 3; k++) varyings[VARYING_SHADOW_POSITION + k] = v.position[k];
+		return VARYING_SHADOW_POSITION + 3;
+	}
+};
+
+// Per-pixel lighting with the normal and specular maps of the model, see
+// shade_phong(). Shades a 2x2 quad per call, lanes laid out as for fragment_quad().
+void shade_phong(const TriangleCmd& tri, int lanes, const float* l1, const float* l2, TGAColor* out);
+
+struct PhongShader : ShaderBase<PhongShader> {
+	static const bool batched = true;
+	const TriangleCmd& tri;
+	const TriangleSetup& setup;
+
+	PhongShader(const TriangleCmd& tri, const TriangleSetup& s) : tri(tri), setup(s) {}
+	// a lone pixel still needs its quad for the derivatives
+	TGAColor fragment(float l1, float l2, int x, int y) const {
+		float b1[4], b2[4];
+		int lane = pixel_quad(setup, l1, l2, x, y, b1, b2);
+		TGAColor colors[4];
+		shade_phong(tri, 1 << lane, b1, b2, colors);
+		return colors[lane];
+	}
+	void fragment_quad(int, int, int lanes, const float* l1, const float* l2, TGAColor* out) const {
+		shade_phong(tri, lanes, l1, l2, out);
+	}
+	static int vertex(const ShaderVertex& v, const Lighting&, float* varyings) {
+		varyings[VARYING_U] = v.uv.x;
+		varyings[VARYING_V] = v.uv.y;
+		for (int k = 0; k < 3; k++) {
+			varyings[VARYING_NORMAL + k] = v.normal[k];
+			varyings[VARYING_TANGENT + k] = v.tangent[k];
+			varyings[VARYING_POSITION + k] = v.position[k];
+		}
+		varyings[VARYING_TANGENT + 3] = v.tangent.w;
+		return MAX_VARYINGS;
+	}
+};
+
+template <class S>
+struct ShaderTag {
+	typedef S type;
+};
+
+// Calls f(ShaderTag<S>()) with the shader type of kind
+template <class F>
+inline void with_shader(ShaderKind kind, F&& f) {
+	switch (kind) {
+	case SHADER_ICE: f(ShaderTag<IceShader>()); break;
+	case SHADER_TEXTURED: f(ShaderTag<TexturedShader>()); break;
+	case SHADER_GOURAUD: f(ShaderTag<GouraudShader>()); break;
+	case SHADER_PHONG: f(ShaderTag<PhongShader>()); break;
+	default: f(ShaderTag<FlatShader>()); break;
+	}
+}
+
+#endif //__SHADER_H__
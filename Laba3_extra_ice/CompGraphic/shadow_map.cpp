@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+#include "shadow_map.h"
+#include "rasterizer.h"
+#include "depth_buffer.h"
+
+ShadowMap::ShadowMap(int size) : size_(size), light_(Mat4f::identity()), bias_(0.0f) {
+}
+
+void ShadowMap::set_light(const Vec3f& light_dir, const Vec3f& center, float radius) {
+    Vec3f f = light_dir;
+    f.normalize();
+    // any up that isn't parallel to the light
+    Vec3f up = std::abs(f.y) < 0.99f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0);
+    Vec3f right = up ^ f;
+    right.normalize();
+    up = f ^ right;
+
+    // x, y: the sphere's silhouette fills the map; z: -1 at the far side of the
+    // sphere, 1 at the side facing the light
+    float s = 1.0f / radius;
+    const Vec3f axes[3] = { right * s, up * s, f * -s };
+    light_ = Mat4f::identity();
+    for (int r = 0; r < 3; r++) {
+        light_[r][0] = axes[r].x;
+        light_[r][1] = axes[r].y;
+        light_[r][2] = axes[r].z;
+        light_[r][3] = -(axes[r] * center);
+    }
+    // depth across five texels: the outer PCF taps sit a texel away from the
+    // point, on a surface lit at a grazing angle that is a lot of depth
+    bias_ = 5.0f * 2.0f / size_;
+}
+
+void ShadowMap::render(const std::vector<Vec3f>& positions, const std::vector<int>& indices) {
+    transform_to_screen(light_, positions.data(), (int)positions.size(), size_, size_, verts_);
+    depth_.assign((size_t)size_ * size_, DEPTH_CLEAR);
+
+    FrameSlice slice = {};
+    slice.x1 = size_;
+    slice.y1 = size_;
+    slice.stride = size_;
+    slice.zbuffer = depth_.data();
+    slice.samples = 1;
+
+    // only the snapped positions, the depth kernel reads nothing else
+    TriangleCmd tri;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int j = 0; j < 3; j++) {
+            int idx = indices[i + j];
+            tri.t[j] = Vec3f((int)(verts_.x[idx] + 0.5f), (int)(verts_.y[idx] + 0.5f), verts_.z[idx]);
+        }
+        rasterize_depth(tri, size_, size_, slice);
+    }
+}
+
+float ShadowMap::visibility(const Vec3f& p) const {
+    if (depth_.empty()) return 1.0f;
+    const float* m[3] = { light_[0], light_[1], light_[2] };
+    float half = size_ * 0.5f;
+    float x = (m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3] + 1.0f) * half;
+    float y = (m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3] + 1.0f) * half;
+    float z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3] + bias_;
+    int cx = (int)(x + 0.5f), cy = (int)(y + 0.5f);
+    if (cx < 0 || cy < 0 || cx >= size_ || cy >= size_) return 1.0f;
+
+    // taps past the border repeat the edge texels
+    int lit = 0;
+    for (int dy = -PCF_RADIUS; dy <= PCF_RADIUS; dy++) {
+        const float* row = depth_.data() + std::min(size_ - 1, std::max(0, cy + dy)) * size_;
+        for (int dx = -PCF_RADIUS; dx <= PCF_RADIUS; dx++) {
+            if (row[std::min(size_ - 1, std::max(0, cx + dx))] <= z) lit++;
+        }
+    }
+    const int taps = (2 * PCF_RADIUS + 1) * (2 * PCF_RADIUS + 1);
+    return (float)lit / taps;
+}
@@ -0,0 +1,39 @@
+#ifndef __SHADOW_MAP_H__
+#define __SHADOW_MAP_H__
+
+#include <vector>
+#include "geometry.h"
+#include "vertex_cache.h"
+
+// Depth of the casters as seen from a directional light. The light's projection
+// is orthographic around a bounding sphere, depth grows towards the light as NDC
+// depth does towards the camera. A light that doesn't move needs the map only
+// once: render() it before the views, they then sample it read-only and may do
+// so concurrently.
+class ShadowMap {
+public:
+	static const int PCF_RADIUS = 1;  // (2r + 1)^2 taps per lookup
+
+	explicit ShadowMap(int size = 1024);
+	// light_dir is the direction the light travels; the map covers the sphere (center, radius)
+	void set_light(const Vec3f& light_dir, const Vec3f& center, float radius);
+	// Depth-only pass over the triangles of indices, three per triangle. Every
+	// position goes through the vertex stage once, the triangles index the result.
+	void render(const std::vector<Vec3f>& positions, const std::vector<int>& indices);
+
+	// Lit fraction 0..1 of the PCF taps around p, p in the model's space.
+	// Points outside the map are lit.
+	float visibility(const Vec3f& p) const;
+
+	int size() const { return size_; }
+	bool empty() const { return depth_.empty(); }
+	const Mat4f& light_matrix() const { return light_; }
+private:
+	int size_;
+	Mat4f light_;   // model space -> light clip space, w = 1
+	float bias_;    // in light depth units, against acne on surfaces lit at a grazing angle
+	ScreenVerts verts_;
+	std::vector<float> depth_;
+};
+
+#endif //__SHADOW_MAP_H__
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cmath>
+#include "texture.h"
+
+namespace {
+
+// std::floor is a library call without SSE4.1
+inline int floor_int(float x) {
+    int i = (int)x;
+    return x < i ? i - 1 : i;
+}
+
+inline int wrap_coord(int i, int n, TextureWrap wrap) {
+    if ((unsigned)i < (unsigned)n) return i;
+    if (wrap == WRAP_CLAMP) return i < 0 ? 0 : n - 1;
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+// Per-channel (a * (256 - f) + b * f) / 256, f in 0..256. Two channels per
+// multiply: each sits in a 16-bit lane and the sum stays below 2^16.
+inline unsigned int lerp_texel(unsigned int a, unsigned int b, int f) {
+    unsigned int g = 256 - f;
+    unsigned int rb = ((a & 0x00FF00FF) * g + (b & 0x00FF00FF) * f + 0x00800080) >> 8;
+    unsigned int ag = (((a >> 8) & 0x00FF00FF) * g + ((b >> 8) & 0x00FF00FF) * f + 0x00800080) >> 8;
+    return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+} // namespace
+
+Texture2D::Texture2D() : layout_(TEXTURE_LINEAR) {
+}
+
+void Texture2D::load(TGAImage& image, TextureLayout layout) {
+    levels_.clear();
+    layout_ = layout;
+    int w = image.get_width(), h = image.get_height(), bpp = image.get_bytespp();
+    if (w <= 0 || h <= 0 || !image.buffer()) return;
+
+    Level base;
+    base.width = w;
+    base.height = h;
+    base.bits = 0;
+    base.row_blocks = 0;
+    base.texels.resize(w * h);
+    const unsigned char* p = image.buffer();
+    for (int i = 0; i < w * h; i++, p += bpp) {
+        TGAColor c(p, bpp);
+        if (bpp == TGAImage::GRAYSCALE) c = TGAColor(p[0], p[0], p[0], 255);
+        else if (bpp == TGAImage::RGB) c.a = 255;
+        base.texels[i] = c.val;
+    }
+    levels_.push_back(base);
+
+    // each level averages 2x2 texels of the previous one, odd sizes repeat the last row/column
+    while (w > 1 || h > 1) {
+        const Level& src = levels_.back();
+        Level dst;
+        dst.width = std::max(1, w / 2);
+        dst.height = std::max(1, h / 2);
+        dst.bits = 0;
+        dst.row_blocks = 0;
+        dst.texels.resize(dst.width * dst.height);
+        for (int y = 0; y < dst.height; y++) {
+            int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < dst.width; x++) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                unsigned int t[4] = { src.texels[x0 + y0 * w], src.texels[x1 + y0 * w],
+                    src.texels[x0 + y1 * w], src.texels[x1 + y1 * w] };
+                unsigned int out = 0;
+                for (int ch = 0; ch < 32; ch += 8) {
+                    int sum = 2;
+                    for (int k = 0; k < 4; k++) sum += (t[k] >> ch) & 0xFF;
+                    out |= (unsigned int)(sum / 4) << ch;
+                }
+                dst.texels[x + y * dst.width] = out;
+            }
+        }
+        w = dst.width;
+        h = dst.height;
+        levels_.push_back(dst);
+    }
+
+    // levels are built row by row, reorder them at the end
+    if (layout_ != TEXTURE_LINEAR) {
+        for (auto& l : levels_) swizzle(l);
+    }
+}
+
+void Texture2D::swizzle(Level& l) {
+    size_t size;
+    if (layout_ == TEXTURE_TILED) {
+        l.row_blocks = (l.width + 3) / 4;
+        size = (size_t)l.row_blocks * ((l.height + 3) / 4) * 16;
+    }
+    else {
+        int bits_x = 0, bits_y = 0;
+        while ((1 << bits_x) < l.width) bits_x++;
+        while ((1 << bits_y) < l.height) bits_y++;
+        l.bits = std::min(bits_x, bits_y);
+        size = (size_t)1 << (bits_x + bits_y);
+    }
+    std::vector<unsigned int> texels(size);
+    for (int y = 0; y < l.height; y++) {
+        for (int x = 0; x < l.width; x++) texels[index(l, x, y)] = l.texels[x + y * l.width];
+    }
+    l.texels.swap(texels);
+}
+
+float Texture2D::lod(float dudx, float dvdx, float dudy, float dvdy) const {
+    float w = (float)levels_[0].width, h = (float)levels_[0].height;
+    float rx = dudx * w * dudx * w + dvdx * h * dvdx * h;
+    float ry = dudy * w * dudy * w + dvdy * h * dvdy * h;
+    float rho2 = std::max(rx, ry);
+    if (!(rho2 > 0.0f)) return 0.0f;
+    return 0.5f * std::log2(rho2);
+}
+
+unsigned int Texture2D::bilinear(const Level& l, TextureWrap wrap, float u, float v) const {
+    // texel centers sit at (i + 0.5) / size
+    float x = u * l.width - 0.5f;
+    float y = v * l.height - 0.5f;
+    int x0 = floor_int(x), y0 = floor_int(y);
+    int wx = (int)((x - x0) * 256.0f), wy = (int)((y - y0) * 256.0f);
+    unsigned int xa = x_part(l, wrap_coord(x0, l.width, wrap)), xb = x_part(l, wrap_coord(x0 + 1, l.width, wrap));
+    unsigned int ya = y_part(l, wrap_coord(y0, l.height, wrap)), yb = y_part(l, wrap_coord(y0 + 1, l.height, wrap));
+    const unsigned int* t = l.texels.data();
+    unsigned int c00 = t[xa + ya], c10 = t[xb + ya];
+    unsigned int c01 = t[xa + yb], c11 = t[xb + yb];
+    return lerp_texel(lerp_texel(c00, c10, wx), lerp_texel(c01, c11, wx), wy);
+}
+
+TGAColor Texture2D::sample(const Sampler& sampler, float u, float v, float lod) const {
+    if (sampler.filter == FILTER_POINT) {
+        const Level& l = levels_[0];
+        int x = wrap_coord(floor_int(u * l.width), l.width, sampler.wrap);
+        int y = wrap_coord(floor_int(v * l.height), l.height, sampler.wrap);
+        return fetch(0, x, y);
+    }
+
+    int last = levels() - 1;
+    lod = std::min((float)last, std::max(0.0f, lod));
+    if (sampler.filter == FILTER_BILINEAR) {
+        int level = (int)(lod + 0.5f);
+        return TGAColor((int)bilinear(levels_[level], sampler.wrap, u, v), TGAImage::RGBA);
+    }
+
+    int level = (int)lod;
+    int f = (int)((lod - level) * 256.0f);
+    unsigned int c = bilinear(levels_[level], sampler.wrap, u, v);
+    if (f > 0 && level < last) c = lerp_texel(c, bilinear(levels_[level + 1], sampler.wrap, u, v), f);
+    return TGAColor((int)c, TGAImage::RGBA);
+}
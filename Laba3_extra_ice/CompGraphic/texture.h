@@ -0,0 +1,87 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+enum TextureFilter {
+	FILTER_POINT,      // nearest texel of level 0
+	FILTER_BILINEAR,   // 2x2 texels of the nearest mip level
+	FILTER_TRILINEAR   // bilinear in the two nearest levels, blended by the LOD fraction
+};
+
+enum TextureWrap {
+	WRAP_REPEAT,
+	WRAP_CLAMP
+};
+
+enum TextureLayout {
+	TEXTURE_LINEAR,   // row after row
+	TEXTURE_TILED,    // 4x4 texel blocks (64 bytes, one cache line) row after row, rows inside a block
+	TEXTURE_MORTON    // Z-order: x and y bits interleaved, 2x2, 4x4, ... blocks are contiguous
+};
+
+struct Sampler {
+	TextureFilter filter;
+	TextureWrap wrap;
+};
+
+// RGBA8 texture with a full mip chain, built once at load time.
+// Texels are packed like TGAColor::val (b, g, r, a), y bottom-up as in TGAImage.
+// The tiled layout pads each level to multiples of 4, Morton to power-of-two
+// sides; neighbouring texels in both directions then mostly share cache lines.
+class Texture2D {
+public:
+	Texture2D();
+	// copies level 0, box-filters the smaller levels down to 1x1
+	void load(TGAImage& image, TextureLayout layout = TEXTURE_LINEAR);
+	bool empty() const { return levels_.empty(); }
+	TextureLayout layout() const { return layout_; }
+	int levels() const { return (int)levels_.size(); }
+	int width(int level = 0) const { return levels_[level].width; }
+	int height(int level = 0) const { return levels_[level].height; }
+
+	// Mip level for the screen-space derivatives of u and v (in texture units 0..1)
+	float lod(float dudx, float dvdx, float dudy, float dvdy) const;
+
+	TGAColor sample(const Sampler& sampler, float u, float v, float lod) const;
+	TGAColor fetch(int level, int x, int y) const {
+		const Level& l = levels_[level];
+		return TGAColor((int)l.texels[index(l, x, y)], TGAImage::RGBA);
+	}
+private:
+	struct Level {
+		int width, height;
+		int bits;          // Morton: low bits of x and y that are interleaved
+		int row_blocks;    // tiled: 4x4 blocks per block row
+		std::vector<unsigned int> texels;
+	};
+	TextureLayout layout_;
+	std::vector<Level> levels_;
+
+	// index = x_part + y_part in both layouts, so a 2x2 footprint needs only four parts
+	unsigned int index(const Level& l, int x, int y) const { return x_part(l, x) + y_part(l, y); }
+	// Morton: the longer side's remaining high bits go above the interleaved ones
+	unsigned int x_part(const Level& l, int x) const {
+		if (layout_ == TEXTURE_LINEAR) return x;
+		if (layout_ == TEXTURE_TILED) return ((x >> 2) << 4) + (x & 3);
+		return spread_bits(x & ((1u << l.bits) - 1)) | ((unsigned int)(x >> l.bits) << (2 * l.bits));
+	}
+	unsigned int y_part(const Level& l, int y) const {
+		if (layout_ == TEXTURE_LINEAR) return y * l.width;
+		if (layout_ == TEXTURE_TILED) return (y >> 2) * (l.row_blocks << 4) + ((y & 3) << 2);
+		return (spread_bits(y & ((1u << l.bits) - 1)) << 1) | ((unsigned int)(y >> l.bits) << (2 * l.bits));
+	}
+	// 0b00abcd -> 0b0a0b0c0d, for values below 2^16
+	static unsigned int spread_bits(unsigned int v) {
+		v = (v | (v << 8)) & 0x00FF00FF;
+		v = (v | (v << 4)) & 0x0F0F0F0F;
+		v = (v | (v << 2)) & 0x33333333;
+		return (v | (v << 1)) & 0x55555555;
+	}
+	void swizzle(Level& l);
+
+	unsigned int bilinear(const Level& l, TextureWrap wrap, float u, float v) const;
+};
+
+#endif //__TEXTURE_H__
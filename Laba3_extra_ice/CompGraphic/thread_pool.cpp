@@ -0,0 +1,67 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int nthreads) : job_(nullptr), count_(0), next_(0), active_(0), generation_(0), stop_(false) {
+    if (nthreads <= 0) nthreads = (int)std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+    for (int i = 1; i < nthreads; i++) {
+        threads_.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+int ThreadPool::size() const {
+    return (int)threads_.size() + 1;
+}
+
+void ThreadPool::run_jobs(int worker) {
+    for (int i = next_.fetch_add(1); i < count_; i = next_.fetch_add(1)) {
+        (*job_)(i, worker);
+    }
+}
+
+void ThreadPool::worker_loop(int worker) {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+        }
+        run_jobs(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--active_ == 0) done_.notify_one();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int, int)>& job) {
+    if (count <= 0) return;
+    if (threads_.empty()) {
+        for (int i = 0; i < count; i++) job(i, 0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &job;
+        count_ = count;
+        next_ = 0;
+        active_ = (int)threads_.size();
+        generation_++;
+    }
+    wake_.notify_all();
+    run_jobs(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return active_ == 0; });
+    job_ = nullptr;
+}
@@ -0,0 +1,36 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers for data-parallel loops. The calling thread works too
+// and always gets worker index 0.
+class ThreadPool {
+private:
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	const std::function<void(int, int)>* job_;
+	int count_;
+	std::atomic<int> next_;
+	int active_;
+	unsigned generation_;
+	bool stop_;
+
+	void worker_loop(int worker);
+	void run_jobs(int worker);
+public:
+	ThreadPool(int nthreads = 0); // 0 - one worker per hardware thread
+	~ThreadPool();
+	int size() const;
+	// Calls job(index, worker) for every index in [0, count) and waits for all of them
+	void parallel_for(int count, const std::function<void(int, int)>& job);
+};
+
+#endif //__THREAD_POOL_H__
@@ -0,0 +1,147 @@
+#include "vertex_cache.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void ScreenVerts::resize(int n) {
+    cx.resize(n);
+    cy.resize(n);
+    cz.resize(n);
+    cw.resize(n);
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    inv_w.resize(n);
+}
+
+void transform_to_screen(const Mat4f& m, const Vec3f* points, int n, int width, int height, ScreenVerts& out) {
+    out.resize(n);
+    const float half_w = width * 0.5f;
+    const float half_h = height * 0.5f;
+    int i = 0;
+
+#if defined(__AVX2__)
+    {
+        // Vec3f is three packed floats, gather x/y/z of 8 points with a stride of 3
+        const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            const float* base = &points[i].x;
+            __m256 px = _mm256_i32gather_ps(base, stride, 4);
+            __m256 py = _mm256_i32gather_ps(base + 1, stride, 4);
+            __m256 pz = _mm256_i32gather_ps(base + 2, stride, 4);
+            __m256 c[4];
+            for (int k = 0; k < 4; k++) {
+                c[k] = _mm256_mul_ps(_mm256_set1_ps(m[k][0]), px);
+                c[k] = _mm256_add_ps(c[k], _mm256_mul_ps(_mm256_set1_ps(m[k][1]), py));
+                c[k] = _mm256_add_ps(c[k], _mm256_mul_ps(_mm256_set1_ps(m[k][2]), pz));
+                c[k] = _mm256_add_ps(c[k], _mm256_set1_ps(m[k][3]));
+            }
+            _mm256_storeu_ps(&out.cx[i], c[0]);
+            _mm256_storeu_ps(&out.cy[i], c[1]);
+            _mm256_storeu_ps(&out.cz[i], c[2]);
+            _mm256_storeu_ps(&out.cw[i], c[3]);
+
+            // w == 0 is left undivided, same as Vec4f::project()
+            __m256 w_zero = _mm256_cmp_ps(c[3], zero, _CMP_EQ_OQ);
+            __m256 w = _mm256_blendv_ps(c[3], one, w_zero);
+            __m256 nx = _mm256_div_ps(c[0], w);
+            __m256 ny = _mm256_div_ps(c[1], w);
+            __m256 nz = _mm256_div_ps(c[2], w);
+
+            _mm256_storeu_ps(&out.x[i], _mm256_mul_ps(_mm256_add_ps(nx, one), _mm256_set1_ps(half_w)));
+            _mm256_storeu_ps(&out.y[i], _mm256_mul_ps(_mm256_add_ps(ny, one), _mm256_set1_ps(half_h)));
+            _mm256_storeu_ps(&out.z[i], nz);
+            _mm256_storeu_ps(&out.inv_w[i], _mm256_div_ps(one, c[3]));
+        }
+    }
+#endif
+#if defined(GEOMETRY_SSE2)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= n; i += 4) {
+            __m128 px = _mm_setr_ps(points[i].x, points[i + 1].x, points[i + 2].x, points[i + 3].x);
+            __m128 py = _mm_setr_ps(points[i].y, points[i + 1].y, points[i + 2].y, points[i + 3].y);
+            __m128 pz = _mm_setr_ps(points[i].z, points[i + 1].z, points[i + 2].z, points[i + 3].z);
+            __m128 c[4];
+            for (int k = 0; k < 4; k++) {
+                c[k] = _mm_mul_ps(_mm_set1_ps(m[k][0]), px);
+                c[k] = _mm_add_ps(c[k], _mm_mul_ps(_mm_set1_ps(m[k][1]), py));
+                c[k] = _mm_add_ps(c[k], _mm_mul_ps(_mm_set1_ps(m[k][2]), pz));
+                c[k] = _mm_add_ps(c[k], _mm_set1_ps(m[k][3]));
+            }
+            _mm_storeu_ps(&out.cx[i], c[0]);
+            _mm_storeu_ps(&out.cy[i], c[1]);
+            _mm_storeu_ps(&out.cz[i], c[2]);
+            _mm_storeu_ps(&out.cw[i], c[3]);
+
+            __m128 w_zero = _mm_cmpeq_ps(c[3], _mm_setzero_ps());
+            __m128 w = _mm_or_ps(_mm_and_ps(w_zero, one), _mm_andnot_ps(w_zero, c[3]));
+            __m128 nx = _mm_div_ps(c[0], w);
+            __m128 ny = _mm_div_ps(c[1], w);
+            __m128 nz = _mm_div_ps(c[2], w);
+
+            _mm_storeu_ps(&out.x[i], _mm_mul_ps(_mm_add_ps(nx, one), _mm_set1_ps(half_w)));
+            _mm_storeu_ps(&out.y[i], _mm_mul_ps(_mm_add_ps(ny, one), _mm_set1_ps(half_h)));
+            _mm_storeu_ps(&out.z[i], nz);
+            _mm_storeu_ps(&out.inv_w[i], _mm_div_ps(one, c[3]));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        Vec4f c = m * Vec4f(points[i], 1.0f);
+        Vec3f ndc = c.project();
+        out.cx[i] = c.x;
+        out.cy[i] = c.y;
+        out.cz[i] = c.z;
+        out.cw[i] = c.w;
+        out.x[i] = (ndc.x + 1.0f) * half_w;
+        out.y[i] = (ndc.y + 1.0f) * half_h;
+        out.z[i] = ndc.z;
+        out.inv_w[i] = 1.0f / c.w;
+    }
+}
+
+// Camera's projection puts w = z_view, which is negative in front of the camera.
+// The tests run on the negated clip vector: same projected point, but w > 0
+// for visible geometry, so the usual -w <= x <= w form applies.
+void compute_outcodes(ScreenVerts& sv, float znear, int width, int height) {
+    int n = sv.size();
+    sv.outcode.resize(n);
+    sv.znear = znear;
+    const float gx = 1.0f + 2.0f * GUARD_BAND_PIXELS / width;
+    const float gy = 1.0f + 2.0f * GUARD_BAND_PIXELS / height;
+    for (int i = 0; i < n; i++) {
+        float x = -sv.cx[i], y = -sv.cy[i], w = -sv.cw[i];
+        unsigned short code = 0;
+        if (x < -w) code |= CLIP_LEFT;
+        if (x > w) code |= CLIP_RIGHT;
+        if (y < -w) code |= CLIP_BOTTOM;
+        if (y > w) code |= CLIP_TOP;
+        if (w < znear) code |= CLIP_NEAR;
+        if (x < -gx * w) code |= GUARD_LEFT;
+        if (x > gx * w) code |= GUARD_RIGHT;
+        if (y < -gy * w) code |= GUARD_BOTTOM;
+        if (y > gy * w) code |= GUARD_TOP;
+        sv.outcode[i] = code;
+    }
+}
+
+VertexCache::VertexCache() : lookups_(0) {
+}
+
+void VertexCache::load(const std::vector<Vec3f>& positions) {
+    positions_ = positions;
+}
+
+void VertexCache::begin(const Mat4f& view_proj, int width, int height, float znear) {
+    lookups_ = 0;
+    transform_to_screen(view_proj, positions_.data(), size(), width, height, verts_);
+    compute_outcodes(verts_, znear, width, height);
+}
+
+float VertexCache::hit_rate() const {
+    return lookups_ > transforms() ? (float)(lookups_ - transforms()) / lookups_ : 0.0f;
+}
@@ -0,0 +1,65 @@
+#ifndef __VERTEX_CACHE_H__
+#define __VERTEX_CACHE_H__
+
+#include <vector>
+#include "geometry.h"
+
+// Output of the vertex stage as structure-of-arrays streams, indexed like the mesh
+struct ScreenVerts {
+	std::vector<float> cx, cy, cz, cw;  // clip space, before the perspective divide
+	std::vector<float> x, y;            // viewport coordinates, not snapped
+	std::vector<float> z;               // NDC depth
+	std::vector<float> inv_w;
+	std::vector<unsigned short> outcode; // ClipBits
+	float znear;
+
+	void resize(int n);
+	int size() const { return (int)x.size(); }
+};
+
+// Per-vertex outcode bits, see compute_outcodes
+enum ClipBits {
+	CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_BOTTOM = 4, CLIP_TOP = 8,  // outside the viewport
+	CLIP_NEAR = 16,                                                // in front of znear
+	GUARD_LEFT = 32, GUARD_RIGHT = 64, GUARD_BOTTOM = 128, GUARD_TOP = 256  // outside the guard band
+};
+
+// Guard band margin around the viewport. Triangles inside it are rasterized unclipped,
+// their screen coords stay well inside the edge kernel's integer range.
+const float GUARD_BAND_PIXELS = 8192.0f;
+
+// Transforms n points (w = 1) with m and maps them onto a width x height viewport.
+// Runs 8 points per step with AVX2, 4 with SSE2, scalar for the tail.
+void transform_to_screen(const Mat4f& m, const Vec3f* points, int n, int width, int height, ScreenVerts& out);
+
+// Classifies every vertex of sv against the frustum sides, the near plane and the guard band
+void compute_outcodes(ScreenVerts& sv, float znear, int width, int height);
+
+// Transformed-vertex cache: every vertex of a mesh goes through transform_to_screen
+// exactly once per view, the passes then only index the result.
+class VertexCache {
+private:
+	std::vector<Vec3f> positions_;
+	ScreenVerts verts_;
+	long long lookups_;
+public:
+	VertexCache();
+	void load(const std::vector<Vec3f>& positions);
+	void begin(const Mat4f& view_proj, int width, int height, float znear); // runs the vertex stage for a new view
+
+	// pixel-snapped screen position and depth, as the rasterizer expects
+	Vec3f screen(int idx) {
+		lookups_++;
+		return Vec3f((int)(verts_.x[idx] + 0.5f), (int)(verts_.y[idx] + 0.5f), verts_.z[idx]);
+	}
+	float inv_w(int idx) const { return verts_.inv_w[idx]; }
+	const ScreenVerts& verts() const { return verts_; }
+	const Vec3f& position(int idx) const { return positions_[idx]; }
+	const std::vector<Vec3f>& positions() const { return positions_; }
+	int size() const { return (int)positions_.size(); }
+	long long transforms() const { return size(); }
+	long long lookups() const { return lookups_; }
+	float hit_rate() const;
+};
+
+#endif //__VERTEX_CACHE_H__
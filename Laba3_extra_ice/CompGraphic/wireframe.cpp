@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cmath>
+#include "wireframe.h"
+
+std::vector<int> unique_edges(const std::vector<int>& indices) {
+    std::vector<unsigned long long> keys;
+    keys.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int k = 0; k < 3; k++) {
+            int a = indices[i + k], b = indices[i + (k + 1) % 3];
+            if (a == b) continue;
+            keys.push_back(((unsigned long long)std::min(a, b) << 32) | (unsigned int)std::max(a, b));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<int> edges(2 * keys.size());
+    for (size_t e = 0; e < keys.size(); e++) {
+        edges[2 * e] = (int)(keys[e] >> 32);
+        edges[2 * e + 1] = (int)(keys[e] & 0xFFFFFFFFu);
+    }
+    return edges;
+}
+
+namespace {
+
+// Line end in viewport coordinates plus depth
+struct LinePoint {
+    float x, y, z;
+};
+
+// Liang-Barsky against [xmin, xmax] x [ymin, ymax], false if nothing is left
+bool clip_line(LinePoint& a, LinePoint& b, float xmin, float ymin, float xmax, float ymax) {
+    float t0 = 0.0f, t1 = 1.0f;
+    float dx = b.x - a.x, dy = b.y - a.y;
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { a.x - xmin, xmax - a.x, a.y - ymin, ymax - a.y };
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            if (q[i] < 0.0f) return false;
+            continue;
+        }
+        float r = q[i] / p[i];
+        if (p[i] < 0.0f) t0 = std::max(t0, r);
+        else t1 = std::min(t1, r);
+        if (t0 > t1) return false;
+    }
+    LinePoint c = a;
+    float dz = b.z - a.z;
+    if (t1 < 1.0f) b = { c.x + t1 * dx, c.y + t1 * dy, c.z + t1 * dz };
+    if (t0 > 0.0f) a = { c.x + t0 * dx, c.y + t0 * dy, c.z + t0 * dz };
+    return true;
+}
+
+// Frame access shared by all lines of the pass
+struct WireTarget {
+    unsigned char* pixels;
+    int width, height, bytespp;
+    const float* zbuffer;
+    float bias;
+    unsigned char rgb[3];  // TGAColor::raw order
+    long long plotted;
+
+    // blends the line color over pixel (x, y) by coverage c in 0..1
+    void plot(int x, int y, float z, float c) {
+        if ((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height || c <= 0.0f) return;
+        int idx = x + y * width;
+        if (zbuffer && z + bias < zbuffer[idx]) return;
+        int f = (int)(c * 256.0f + 0.5f);
+        unsigned char* p = pixels + idx * bytespp;
+        for (int ch = 0; ch < 3; ch++) p[ch] = (unsigned char)((p[ch] * (256 - f) + rgb[ch] * f) >> 8);
+        plotted++;
+    }
+};
+
+inline float fpart(float x) { return x - std::floor(x); }
+inline float rfpart(float x) { return 1.0f - fpart(x); }
+
+// Xiaolin Wu's line, pixel centers at integer coordinates
+void wu_line(WireTarget& t, LinePoint a, LinePoint b) {
+    bool steep = std::abs(b.y - a.y) > std::abs(b.x - a.x);
+    if (steep) {
+        std::swap(a.x, a.y);
+        std::swap(b.x, b.y);
+    }
+    if (a.x > b.x) std::swap(a, b);
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float gradient = dx == 0.0f ? 1.0f : dy / dx;
+    float zgradient = dx == 0.0f ? 0.0f : (b.z - a.z) / dx;
+    // steep lines were stepped along y, plot() wants the frame's x and y back
+    auto plot = [&](int major, int minor, float z, float c) {
+        if (steep) t.plot(minor, major, z, c);
+        else t.plot(major, minor, z, c);
+    };
+
+    // end points cover the pixel they fall into by the part of it they reach
+    float xend = std::floor(a.x + 0.5f);
+    float yend = a.y + gradient * (xend - a.x);
+    float zend = a.z + zgradient * (xend - a.x);
+    float xgap = rfpart(a.x + 0.5f);
+    int x0 = (int)xend;
+    int y0 = (int)std::floor(yend);
+    plot(x0, y0, zend, rfpart(yend) * xgap);
+    plot(x0, y0 + 1, zend, fpart(yend) * xgap);
+    float intery = yend + gradient;
+    float z = zend + zgradient;
+
+    xend = std::floor(b.x + 0.5f);
+    yend = b.y + gradient * (xend - b.x);
+    zend = b.z + zgradient * (xend - b.x);
+    xgap = fpart(b.x + 0.5f);
+    int x1 = (int)xend;
+    int y1 = (int)std::floor(yend);
+    if (x1 != x0) {
+        plot(x1, y1, zend, rfpart(yend) * xgap);
+        plot(x1, y1 + 1, zend, fpart(yend) * xgap);
+    }
+
+    for (int x = x0 + 1; x < x1; x++) {
+        int y = (int)std::floor(intery);
+        float f = intery - y;
+        plot(x, y, z, 1.0f - f);
+        plot(x, y + 1, z, f);
+        intery += gradient;
+        z += zgradient;
+    }
+}
+
+} // namespace
+
+void draw_wireframe(const ScreenVerts& sv, const std::vector<int>& edges, const TGAColor& color,
+    ColorBuffer& target, const float* zbuffer, float bias, WireStats& stats) {
+    WireTarget t;
+    t.width = target.width();
+    t.height = target.height();
+    t.bytespp = target.bytespp();
+    t.zbuffer = zbuffer;
+    t.bias = bias;
+    for (int ch = 0; ch < 3; ch++) t.rgb[ch] = color.raw[ch];
+    t.plotted = 0;
+
+    // half a pixel past the border still covers the edge pixels
+    const float xmax = t.width - 0.5f, ymax = t.height - 0.5f;
+    for (size_t e = 0; e + 1 < edges.size(); e += 2) {
+        int i0 = edges[e], i1 = edges[e + 1];
+        stats.edges++;
+        unsigned short c0 = sv.outcode[i0], c1 = sv.outcode[i1];
+        if (((c0 | c1) & CLIP_NEAR) || (c0 & c1)) continue;
+        LinePoint a = { sv.x[i0], sv.y[i0], sv.z[i0] };
+        LinePoint b = { sv.x[i1], sv.y[i1], sv.z[i1] };
+        if (!clip_line(a, b, -0.5f, -0.5f, xmax, ymax)) continue;
+        // only the tiles under the line, the untouched ones keep their clear state;
+        // Wu plots one pixel past the rounded ends across the line
+        t.pixels = target.materialize((int)std::floor(std::min(a.x, b.x)) - 1, (int)std::floor(std::min(a.y, b.y)) - 1,
+            (int)std::ceil(std::max(a.x, b.x)) + 1, (int)std::ceil(std::max(a.y, b.y)) + 1);
+        stats.drawn++;
+        wu_line(t, a, b);
+    }
+    stats.pixels += t.plotted;
+}
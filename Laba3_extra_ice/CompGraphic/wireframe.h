@@ -0,0 +1,32 @@
+#ifndef __WIREFRAME_H__
+#define __WIREFRAME_H__
+
+#include <vector>
+#include "tgaimage.h"
+#include "vertex_cache.h"
+#include "color_buffer.h"
+
+// Unique undirected edges of a triangle index buffer (three indices per
+// triangle): two vertex indices per edge, the smaller first, sorted.
+// An edge shared by two triangles appears once.
+std::vector<int> unique_edges(const std::vector<int>& indices);
+
+struct WireStats {
+	int edges;         // submitted
+	int drawn;         // left after near-plane rejection and viewport clipping
+	long long pixels;  // fragments blended, after the depth test
+
+	WireStats() : edges(0), drawn(0), pixels(0) {}
+};
+
+// Draws every edge (pairs of indices into sv) as an anti-aliased line (Xiaolin
+// Wu) in one pass over target: each fragment is blended over the frame by its
+// coverage, the color's alpha is ignored. Edges crossing the near plane are
+// skipped, the rest are clipped to the viewport before stepping.
+// With zbuffer (frame-sized floats, row stride = width) fragments more than
+// bias behind the stored depth are dropped; depth is linear along the line in
+// screen space like everywhere else.
+void draw_wireframe(const ScreenVerts& sv, const std::vector<int>& edges, const TGAColor& color,
+	ColorBuffer& target, const float* zbuffer, float bias, WireStats& stats);
+
+#endif //__WIREFRAME_H__